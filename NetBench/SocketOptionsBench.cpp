@@ -0,0 +1,276 @@
+#include <iostream>
+#include "../NetCommon/netp_net.h"
+
+// measures what each socket option costs & buys over loopback, server and client in one process.
+// g++ -std=c++17 -O2 SocketOptionsBench.cpp -pthread
+
+enum class BenchMsgTypes : uint32_t
+{
+    Ping,
+    Update,
+    UpdateAck,
+    Bulk,
+    BulkDone,
+};
+
+using Clock = std::chrono::steady_clock;
+
+class BenchServer : public netp::net::server_interface<BenchMsgTypes>
+{
+public:
+    BenchServer(uint16_t nPort) : netp::net::server_interface<BenchMsgTypes>(nPort)
+    {
+    }
+
+    std::atomic<uint32_t> nValidated = 0;
+    uint64_t nBulkBytes = 0;
+    uint64_t nBulkTarget = 0;
+
+protected:
+    virtual bool OnClientConnect(std::shared_ptr<netp::net::connection<BenchMsgTypes>> client)
+    {
+        return true;
+    }
+
+    virtual void OnClientValidated(std::shared_ptr<netp::net::connection<BenchMsgTypes>> client)
+    {
+        nValidated++;
+    }
+
+    virtual void OnMessage(std::shared_ptr<netp::net::connection<BenchMsgTypes>> client, netp::net::message<BenchMsgTypes> &msg)
+    {
+        switch (msg.header.id)
+        {
+        case BenchMsgTypes::Ping:
+            client->Send(msg);
+            break;
+
+        case BenchMsgTypes::Update:
+        {
+            // only every 8th update is answered, like a server acking input in batches - the acks the
+            // client waits for under Nagle are then delayed ones
+            uint32_t nSeq;
+            int64_t nStamp;
+            msg >> nStamp >> nSeq;
+            if (nSeq % 8 == 7)
+            {
+                netp::net::message<BenchMsgTypes> ack;
+                ack.header.id = BenchMsgTypes::UpdateAck;
+                ack << nStamp;
+                client->Send(ack);
+            }
+        }
+        break;
+
+        case BenchMsgTypes::Bulk:
+            nBulkBytes += msg.body.size();
+            if (nBulkBytes >= nBulkTarget)
+            {
+                netp::net::message<BenchMsgTypes> done;
+                done.header.id = BenchMsgTypes::BulkDone;
+                client->Send(done);
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+};
+
+class BenchClient : public netp::net::client_interface<BenchMsgTypes>
+{
+public:
+    std::vector<double> vLatencies; // microseconds
+    bool bBulkDone = false;
+
+    void Send(const netp::net::message<BenchMsgTypes> &msg, netp::net::priority nPriority = netp::net::priority::normal)
+    {
+        m_connection->Send(msg, nPriority);
+    }
+
+protected:
+    virtual void OnMessage(netp::net::message<BenchMsgTypes> &msg)
+    {
+        switch (msg.header.id)
+        {
+        case BenchMsgTypes::Ping:
+        case BenchMsgTypes::UpdateAck:
+        {
+            int64_t nStamp;
+            msg >> nStamp;
+            vLatencies.push_back(double(Clock::now().time_since_epoch().count() - nStamp) / 1000.0);
+        }
+        break;
+
+        case BenchMsgTypes::BulkDone:
+            bBulkDone = true;
+            break;
+
+        default:
+            break;
+        }
+    }
+};
+
+struct Profile
+{
+    const char *sName;
+    netp::net::socket_options options;
+};
+
+// runs server game loop on its own thread for the duration of a test
+struct BenchRun
+{
+    BenchRun(uint16_t nPort, const netp::net::socket_options &options)
+        : server(nPort)
+    {
+        server.SetSocketOptions(options);
+        server.Start();
+        thrServer = std::thread([this]()
+                                { while (bRunning) server.Update(-1, std::chrono::milliseconds(1)); });
+
+        client.SetSocketOptions(options);
+        client.Connect("127.0.0.1", nPort);
+        auto tpGiveUp = Clock::now() + std::chrono::seconds(2);
+        while (server.nValidated == 0 && Clock::now() < tpGiveUp)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        // let session reply arrive before anything is sent
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    ~BenchRun()
+    {
+        bRunning = false;
+        thrServer.join();
+        client.Disconnect();
+    }
+
+    BenchServer server;
+    BenchClient client;
+    std::atomic<bool> bRunning = true;
+    std::thread thrServer;
+};
+
+void PrintLatencies(const char *sProfile, const char *sTest, std::vector<double> &v)
+{
+    if (v.empty())
+    {
+        std::printf("%-22s %-12s no replies\n", sProfile, sTest);
+        return;
+    }
+
+    std::sort(v.begin(), v.end());
+    std::printf("%-22s %-12s p50 %8.1fus  p99 %8.1fus  max %8.1fus  (%zu samples)\n", sProfile, sTest,
+                v[v.size() / 2], v[v.size() * 99 / 100], v.back(), v.size());
+}
+
+// request / reply, one small message in flight at a time
+void BenchPingPong(const Profile &profile, uint16_t nPort)
+{
+    BenchRun run(nPort, profile.options);
+    for (uint32_t i = 0; i < 2000; i++)
+    {
+        netp::net::message<BenchMsgTypes> msg;
+        msg.header.id = BenchMsgTypes::Ping;
+        msg << int64_t(Clock::now().time_since_epoch().count());
+        run.client.Send(msg);
+
+        size_t nBefore = run.client.vLatencies.size();
+        auto tpGiveUp = Clock::now() + std::chrono::seconds(1);
+        while (run.client.vLatencies.size() == nBefore && Clock::now() < tpGiveUp)
+            run.client.Update(-1, std::chrono::milliseconds(1));
+    }
+    PrintLatencies(profile.sName, "ping-pong", run.client.vLatencies);
+}
+
+// small updates streamed every 250us, answered in batches - where Nagle meets delayed acks
+void BenchUpdates(const Profile &profile, uint16_t nPort)
+{
+    BenchRun run(nPort, profile.options);
+    auto tpNext = Clock::now();
+    for (uint32_t i = 0; i < 4000; i++)
+    {
+        netp::net::message<BenchMsgTypes> msg;
+        msg.header.id = BenchMsgTypes::Update;
+        msg << i << int64_t(Clock::now().time_since_epoch().count());
+        run.client.Send(msg);
+
+        tpNext += std::chrono::microseconds(250);
+        while (Clock::now() < tpNext)
+            run.client.Update();
+    }
+
+    auto tpGiveUp = Clock::now() + std::chrono::milliseconds(500);
+    while (run.client.vLatencies.size() < 500 && Clock::now() < tpGiveUp)
+        run.client.Update(-1, std::chrono::milliseconds(1));
+    PrintLatencies(profile.sName, "updates", run.client.vLatencies);
+}
+
+// 256MB in 64KB messages as fast as the socket takes them
+void BenchBulk(const Profile &profile, uint16_t nPort)
+{
+    constexpr size_t nChunk = 64 * 1024;
+    constexpr size_t nTotal = 256 * 1024 * 1024;
+
+    BenchRun run(nPort, profile.options);
+    run.server.nBulkTarget = nTotal;
+
+    netp::net::message<BenchMsgTypes> msg;
+    msg.header.id = BenchMsgTypes::Bulk;
+    msg.body.resize(nChunk);
+    msg.header.size = uint32_t(msg.size());
+
+    auto tpStart = Clock::now();
+    for (size_t n = 0; n < nTotal; n += nChunk)
+        run.client.Send(msg, netp::net::priority::bulk);
+
+    auto tpGiveUp = Clock::now() + std::chrono::seconds(30);
+    while (!run.client.bBulkDone && Clock::now() < tpGiveUp)
+        run.client.Update(-1, std::chrono::milliseconds(1));
+
+    std::chrono::duration<double> elapsed = Clock::now() - tpStart;
+    std::printf("%-22s %-12s %8.1f MB/s\n", profile.sName, "bulk",
+                run.client.bBulkDone ? double(nTotal) / (1024 * 1024) / elapsed.count() : 0.0);
+}
+
+int main()
+{
+    std::vector<Profile> vProfiles;
+
+    Profile nagle = {"nagle (kernel default)"};
+    nagle.options.bNoDelay = false;
+    vProfiles.push_back(nagle);
+
+    Profile nodelay = {"nodelay"};
+    vProfiles.push_back(nodelay);
+
+    Profile quickack = {"nodelay+quickack"};
+    quickack.options.bQuickAck = true;
+    vProfiles.push_back(quickack);
+
+    Profile busypoll = {"nodelay+busypoll 50us"};
+    busypoll.options.nBusyPoll = 50;
+    vProfiles.push_back(busypoll);
+
+    Profile buffers = {"nodelay+4MB buffers"};
+    buffers.options.nSendBuffer = buffers.options.nReceiveBuffer = 4 * 1024 * 1024;
+    vProfiles.push_back(buffers);
+
+    Profile lowat = {"nodelay+lowat 16KB"};
+    lowat.options.nNotSentLowat = 16 * 1024;
+    vProfiles.push_back(lowat);
+
+    // quieten connection logging, only results are of interest
+    netp::net::SetLogging(false);
+
+    uint16_t nPort = 61100;
+    for (auto &profile : vProfiles)
+    {
+        BenchPingPong(profile, nPort++);
+        BenchUpdates(profile, nPort++);
+        BenchBulk(profile, nPort++);
+    }
+
+    return 0;
+}
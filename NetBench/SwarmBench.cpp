@@ -0,0 +1,164 @@
+#include <iostream>
+#include <fstream>
+#include "../NetCommon/netp_net.h"
+
+// drives thousands of bot clients from one process through a client_swarm: every bot pings once per interval
+// & the round trips are reported with the process's threads & memory. without a host an echo server runs in
+// process too, which needs twice the file descriptors (ulimit -n).
+// g++ -std=c++17 -O2 SwarmBench.cpp -pthread
+// ./a.out [bots=2000] [seconds=10] [host port]
+
+enum class BenchMsgTypes : uint32_t
+{
+    Ping,
+};
+
+using Clock = std::chrono::steady_clock;
+
+class EchoServer : public netp::net::server_interface<BenchMsgTypes>
+{
+public:
+    EchoServer(uint16_t nPort) : netp::net::server_interface<BenchMsgTypes>(nPort)
+    {
+    }
+
+protected:
+    virtual bool OnClientConnect(std::shared_ptr<netp::net::connection<BenchMsgTypes>> client)
+    {
+        return true;
+    }
+
+    virtual void OnMessage(std::shared_ptr<netp::net::connection<BenchMsgTypes>> client, netp::net::message<BenchMsgTypes> &msg)
+    {
+        client->Send(msg);
+    }
+};
+
+class Bot : public netp::net::client_interface<BenchMsgTypes>
+{
+public:
+    Bot(netp::net::client_swarm<BenchMsgTypes> &swarm) : netp::net::client_interface<BenchMsgTypes>(swarm)
+    {
+    }
+
+    std::vector<double> *pLatencies = nullptr; // microseconds, shared by every bot - only touched by swarm's Update()
+    bool bAnswered = true;
+
+    void Ping()
+    {
+        if (!bAnswered || !IsConnected())
+            return;
+
+        netp::net::message<BenchMsgTypes> msg;
+        msg.header.id = BenchMsgTypes::Ping;
+        msg << int64_t(Clock::now().time_since_epoch().count());
+        m_connection->Send(msg);
+        bAnswered = false;
+    }
+
+protected:
+    virtual void OnMessage(netp::net::message<BenchMsgTypes> &msg)
+    {
+        int64_t nStamp;
+        msg >> nStamp;
+        pLatencies->push_back(double(Clock::now().time_since_epoch().count() - nStamp) / 1000.0);
+        bAnswered = true;
+    }
+};
+
+// resident memory & thread count of this process
+void ReadProcessStatus(size_t &nResidentKB, size_t &nThreads)
+{
+    nResidentKB = nThreads = 0;
+    std::ifstream status("/proc/self/status");
+    std::string sLine;
+    while (std::getline(status, sLine))
+    {
+        if (sLine.rfind("VmRSS:", 0) == 0)
+            nResidentKB = std::strtoull(sLine.c_str() + 6, nullptr, 10);
+        else if (sLine.rfind("Threads:", 0) == 0)
+            nThreads = std::strtoull(sLine.c_str() + 8, nullptr, 10);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t nBots = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000;
+    int nSeconds = argc > 2 ? std::atoi(argv[2]) : 10;
+    std::string sHost = argc > 4 ? argv[3] : "127.0.0.1";
+    uint16_t nPort = argc > 4 ? uint16_t(std::atoi(argv[4])) : 61300;
+    auto interval = std::chrono::microseconds(100000);
+
+    // quieten connection logging, only results are of interest
+    netp::net::SetLogging(false);
+
+    std::unique_ptr<EchoServer> pServer;
+    std::atomic<bool> bRunning = true;
+    std::thread thrServer;
+    if (argc <= 4)
+    {
+        pServer = std::make_unique<EchoServer>(nPort);
+        pServer->Start();
+        thrServer = std::thread([&]()
+                                { while (bRunning) pServer->Update(-1, std::chrono::milliseconds(1)); });
+    }
+
+    std::vector<double> vLatencies;
+    {
+        netp::net::client_swarm<BenchMsgTypes> swarm;
+        std::vector<std::unique_ptr<Bot>> vBots;
+
+        auto tpStart = Clock::now();
+        for (size_t i = 0; i < nBots; i++)
+        {
+            vBots.push_back(std::make_unique<Bot>(swarm));
+            vBots.back()->pLatencies = &vLatencies;
+            vBots.back()->Connect(sHost, nPort);
+        }
+        std::chrono::duration<double> connecting = Clock::now() - tpStart;
+
+        // bots ping in turn, spread evenly over each interval
+        auto tpEnd = Clock::now() + std::chrono::seconds(nSeconds);
+        auto tpNext = Clock::now();
+        size_t nNext = 0;
+        while (Clock::now() < tpEnd)
+        {
+            while (Clock::now() >= tpNext)
+            {
+                vBots[nNext]->Ping();
+                nNext = (nNext + 1) % vBots.size();
+                tpNext += interval / vBots.size();
+            }
+            swarm.Update(-1, std::chrono::milliseconds(1));
+        }
+
+        size_t nConnected = 0;
+        for (auto &pBot : vBots)
+            nConnected += pBot->IsConnected() ? 1 : 0;
+
+        size_t nResidentKB, nThreads;
+        ReadProcessStatus(nResidentKB, nThreads);
+
+        std::printf("%zu of %zu bots connected (connect calls took %.2fs), swarm threads %zu, process threads %zu, rss %.1f MB%s\n",
+                    nConnected, nBots, connecting.count(), swarm.GetThreadCount(), nThreads, nResidentKB / 1024.0,
+                    pServer ? " incl. server" : "");
+
+        vBots.clear();
+    }
+
+    bRunning = false;
+    if (thrServer.joinable())
+        thrServer.join();
+    pServer.reset();
+
+    if (vLatencies.empty())
+    {
+        std::printf("no replies\n");
+        return 1;
+    }
+
+    std::sort(vLatencies.begin(), vLatencies.end());
+    std::printf("%zu pings (%.0f/s)  p50 %.1fus  p99 %.1fus  max %.1fus\n", vLatencies.size(), vLatencies.size() / double(nSeconds),
+                vLatencies[vLatencies.size() / 2], vLatencies[vLatencies.size() * 99 / 100], vLatencies.back());
+    return 0;
+}
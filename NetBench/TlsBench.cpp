@@ -0,0 +1,259 @@
+#include <iostream>
+#include <ctime>
+#include "../NetCommon/netp_net.h"
+
+// what encryption costs over loopback: bulk throughput & CPU per byte for plaintext, TLS and TLS with
+// kernel encryption of sent data, then how fast a reconnect storm gets through full vs resumed handshakes.
+// g++ -std=c++17 -O2 -DNETP_USE_TLS TlsBench.cpp -pthread -lssl -lcrypto
+
+#ifndef NETP_USE_TLS
+#error TlsBench needs -DNETP_USE_TLS
+#endif
+
+enum class BenchMsgTypes : uint32_t
+{
+    Bulk,
+    BulkDone,
+};
+
+using Clock = std::chrono::steady_clock;
+
+// CPU seconds used by every thread of the process, server & client alike
+double ProcessCpuSeconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec) / 1e9;
+}
+
+class BenchServer : public netp::net::server_interface<BenchMsgTypes>
+{
+public:
+    BenchServer(uint16_t nPort) : netp::net::server_interface<BenchMsgTypes>(nPort)
+    {
+    }
+
+    std::atomic<uint32_t> nValidated = 0;
+    uint64_t nBulkBytes = 0;
+    uint64_t nBulkTarget = 0;
+
+protected:
+    virtual bool OnClientConnect(std::shared_ptr<netp::net::connection<BenchMsgTypes>> client)
+    {
+        return true;
+    }
+
+    virtual void OnClientValidated(std::shared_ptr<netp::net::connection<BenchMsgTypes>> client)
+    {
+        nValidated++;
+    }
+
+    virtual void OnMessage(std::shared_ptr<netp::net::connection<BenchMsgTypes>> client, netp::net::message<BenchMsgTypes> &msg)
+    {
+        if (msg.header.id != BenchMsgTypes::Bulk)
+            return;
+
+        nBulkBytes += msg.body.size();
+        if (nBulkBytes >= nBulkTarget)
+        {
+            netp::net::message<BenchMsgTypes> done;
+            done.header.id = BenchMsgTypes::BulkDone;
+            client->Send(done);
+        }
+    }
+};
+
+class BenchClient : public netp::net::client_interface<BenchMsgTypes>
+{
+public:
+    bool bBulkDone = false;
+
+    void Send(const netp::net::message<BenchMsgTypes> &msg, netp::net::priority nPriority = netp::net::priority::normal)
+    {
+        m_connection->Send(msg, nPriority);
+    }
+
+    bool IsKernelTls()
+    {
+        return m_connection && m_connection->IsKernelTls();
+    }
+
+protected:
+    virtual void OnMessage(netp::net::message<BenchMsgTypes> &msg)
+    {
+        if (msg.header.id == BenchMsgTypes::BulkDone)
+            bBulkDone = true;
+    }
+};
+
+enum class Transport
+{
+    plain,
+    tls,
+    ktls,
+};
+
+struct Profile
+{
+    const char *sName;
+    Transport transport;
+};
+
+std::shared_ptr<netp::net::tls_context> MakeServerContext(Transport transport)
+{
+    if (transport == Transport::plain)
+        return nullptr;
+
+    auto pContext = std::make_shared<netp::net::tls_context>(netp::net::tls_role::server);
+    pContext->UseSelfSigned();
+    pContext->SetKernelTls(transport == Transport::ktls);
+    return pContext;
+}
+
+std::shared_ptr<netp::net::tls_context> MakeClientContext(Transport transport)
+{
+    if (transport == Transport::plain)
+        return nullptr;
+
+    auto pContext = std::make_shared<netp::net::tls_context>(netp::net::tls_role::client);
+    pContext->SetKernelTls(transport == Transport::ktls);
+    return pContext;
+}
+
+// runs server game loop on its own thread for the duration of a test
+struct BenchRun
+{
+    BenchRun(uint16_t nPort, std::shared_ptr<netp::net::tls_context> pServerContext)
+        : server(nPort)
+    {
+        if (pServerContext)
+            server.EnableTls(pServerContext);
+        server.Start();
+        thrServer = std::thread([this]()
+                                { while (bRunning) server.Update(-1, std::chrono::milliseconds(1)); });
+    }
+
+    ~BenchRun()
+    {
+        bRunning = false;
+        thrServer.join();
+    }
+
+    // connect a client & wait until server has validated it
+    bool Join(BenchClient &client, uint16_t nPort, std::shared_ptr<netp::net::tls_context> pClientContext)
+    {
+        uint32_t nBefore = server.nValidated;
+        if (pClientContext)
+            client.EnableTls(pClientContext);
+        client.Connect("127.0.0.1", nPort);
+
+        auto tpGiveUp = Clock::now() + std::chrono::seconds(2);
+        while (server.nValidated == nBefore && Clock::now() < tpGiveUp)
+            std::this_thread::yield();
+        return server.nValidated != nBefore;
+    }
+
+    BenchServer server;
+    std::atomic<bool> bRunning = true;
+    std::thread thrServer;
+};
+
+// 256MB in 64KB messages as fast as the socket takes them
+void BenchBulk(const Profile &profile, uint16_t nPort)
+{
+    constexpr size_t nChunk = 64 * 1024;
+    constexpr size_t nTotal = 256 * 1024 * 1024;
+
+    BenchRun run(nPort, MakeServerContext(profile.transport));
+    run.server.nBulkTarget = nTotal;
+
+    BenchClient client;
+    if (!run.Join(client, nPort, MakeClientContext(profile.transport)))
+    {
+        std::printf("%-12s %-10s could not connect\n", profile.sName, "bulk");
+        return;
+    }
+    // let session reply arrive before anything is sent
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    netp::net::message<BenchMsgTypes> msg;
+    msg.header.id = BenchMsgTypes::Bulk;
+    msg.body.resize(nChunk);
+    msg.header.size = uint32_t(msg.size());
+
+    auto tpStart = Clock::now();
+    double dCpuStart = ProcessCpuSeconds();
+    for (size_t n = 0; n < nTotal; n += nChunk)
+        client.Send(msg, netp::net::priority::bulk);
+
+    auto tpGiveUp = Clock::now() + std::chrono::seconds(60);
+    while (!client.bBulkDone && Clock::now() < tpGiveUp)
+        client.Update(-1, std::chrono::milliseconds(1));
+
+    std::chrono::duration<double> elapsed = Clock::now() - tpStart;
+    double dCpu = ProcessCpuSeconds() - dCpuStart;
+    double dMB = double(nTotal) / (1024 * 1024);
+    if (!client.bBulkDone)
+        std::printf("%-12s %-10s timed out\n", profile.sName, "bulk");
+    else
+        std::printf("%-12s %-10s %8.1f MB/s  %8.1f MB/cpu-s  kernel tx %s\n", profile.sName, "bulk",
+                    dMB / elapsed.count(), dMB / dCpu, client.IsKernelTls() ? "yes" : "no");
+    client.Disconnect();
+}
+
+// nClients connect one after the other & drop straight away, as after a server restart. with a shared
+// client context every handshake after the first resumes the session ticket of the one before
+void BenchReconnectStorm(const Profile &profile, uint16_t nPort, bool bResume)
+{
+    constexpr uint32_t nClients = 200;
+
+    auto pServerContext = MakeServerContext(profile.transport);
+    BenchRun run(nPort, pServerContext);
+    auto pShared = MakeClientContext(profile.transport);
+
+    uint32_t nJoined = 0;
+    auto tpStart = Clock::now();
+    double dCpuStart = ProcessCpuSeconds();
+    for (uint32_t i = 0; i < nClients; i++)
+    {
+        BenchClient client;
+        if (run.Join(client, nPort, bResume ? pShared : MakeClientContext(profile.transport)))
+            nJoined++;
+        client.Disconnect();
+    }
+
+    std::chrono::duration<double> elapsed = Clock::now() - tpStart;
+    double dCpu = ProcessCpuSeconds() - dCpuStart;
+    std::printf("%-12s %-10s %8.1f conn/s  %8.1f us cpu/conn  full %u resumed %u\n", profile.sName,
+                bResume ? "resumed" : "full", nJoined / elapsed.count(), dCpu * 1e6 / std::max(nJoined, 1u),
+                pServerContext ? uint32_t(pServerContext->FullHandshakes()) : 0,
+                pServerContext ? uint32_t(pServerContext->ResumedHandshakes()) : 0);
+}
+
+int main()
+{
+    std::vector<Profile> vProfiles = {
+        {"plaintext", Transport::plain},
+        {"tls", Transport::tls},
+        {"tls+ktls", Transport::ktls},
+    };
+
+    // quieten connection logging, only results are of interest
+    netp::net::SetLogging(false);
+
+    uint16_t nPort = 61200;
+    for (auto &profile : vProfiles)
+        BenchBulk(profile, nPort++);
+
+    for (auto &profile : vProfiles)
+    {
+        if (profile.transport == Transport::ktls)
+            continue; // handshakes are the same with or without kernel tx
+
+        BenchReconnectStorm(profile, nPort++, false);
+        if (profile.transport != Transport::plain)
+            BenchReconnectStorm(profile, nPort++, true);
+    }
+
+    return 0;
+}
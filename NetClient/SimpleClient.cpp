@@ -9,6 +9,8 @@ enum class CustomMsgTypes : uint32_t
     ServerPing,
     MessageAll,
     ServerMessage,
+    Heartbeat,
+    ServerShutdown,
 };
 
 class CustomClient : public netp::net::client_interface<CustomMsgTypes>
@@ -19,8 +21,8 @@ public:
         netp::net::message<CustomMsgTypes> msg;
         msg.header.id = CustomMsgTypes::ServerPing;
 
-        // based on system time, care when using with client/server. measures round trip time from client->server->client
-        std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
+        // monotonic time, only ever compared with this client's own clock. measures round trip time from client->server->client
+        std::chrono::steady_clock::time_point timeNow = std::chrono::steady_clock::now();
 
         msg << timeNow;
         m_connection->Send(msg);
@@ -32,6 +34,59 @@ public:
         msg.header.id = CustomMsgTypes::MessageAll;
         m_connection->Send(msg);
     }
+
+    // answer server heartbeat so server's idle timer sees us as alive
+    void Heartbeat()
+    {
+        netp::net::message<CustomMsgTypes> msg;
+        msg.header.id = CustomMsgTypes::Heartbeat;
+        m_connection->Send(msg);
+    }
+
+protected:
+    // dispatched from Update() for every message from server
+    virtual void OnMessage(netp::net::message<CustomMsgTypes> &msg)
+    {
+        switch (msg.header.id)
+        {
+        case CustomMsgTypes::ServerAccept:
+        {
+            // server has responded to ping request
+            std::cout << "Server Accepted Connection\n\r";
+        }
+        break;
+
+        case CustomMsgTypes::ServerPing:
+        {
+            std::chrono::steady_clock::time_point timeNow = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::time_point timeThen;
+            msg >> timeThen;
+            std::cout << "Ping: " << std::chrono::duration<double>(timeNow - timeThen).count() << "\n\r";
+        }
+        break;
+
+        case CustomMsgTypes::ServerMessage:
+        {
+            // server responded to ping request
+            uint32_t clientID;
+            msg >> clientID;
+            std::cout << "Hello from [" << clientID << "]\n\r";
+        }
+        break;
+
+        case CustomMsgTypes::Heartbeat:
+        {
+            Heartbeat();
+        }
+        break;
+
+        case CustomMsgTypes::ServerShutdown:
+        {
+            std::cout << "Server Shutting Down\n\r";
+        }
+        break;
+        }
+    }
 };
 
 int kbhit(void)
@@ -65,6 +120,7 @@ int main()
     //  bool key[3] = {false, false, false};
     // bool old_key[3] = {false, false, false};
     bool bQuit = false;
+    int nReconnectAttempts = 0;
     while (!bQuit)
     {
 
@@ -81,6 +137,10 @@ int main()
             // if 3 pressed{
             // bQuit = true;
             //}
+
+            // handle server messages, sleeping on the queue instead of spinning while idle
+            c.Update(-1, std::chrono::milliseconds(16));
+
             if (kbhit())
             {
                 int inp = getch();
@@ -115,38 +175,14 @@ int main()
                 // printw("No key pressed yet...\n");
                 // refresh();
             }
-            if (!c.Incoming().empty())
-            {
-                auto msg = c.Incoming().pop_front().msg;
-
-                switch (msg.header.id)
-                {
-                case CustomMsgTypes::ServerAccept:
-                {
-                    // server has responded to ping request
-                    std::cout << "Server Accepted Connection\n\r";
-                }
-                break;
-
-                case CustomMsgTypes::ServerPing:
-                {
-                    std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
-                    std::chrono::system_clock::time_point timeThen;
-                    msg >> timeThen;
-                    std::cout << "Ping: " << std::chrono::duration<double>(timeNow - timeThen).count() << "\n\r";
-                }
-                break;
-
-                case CustomMsgTypes::ServerMessage:
-                {
-                    // server responded to ping request
-                    uint32_t clientID;
-                    msg >> clientID;
-                    std::cout << "Hello from [" << clientID << "]\n\r";
-                }
-                break;
-                }
-            }
+        }
+        else if (nReconnectAttempts < 3)
+        {
+            // connection dropped, try to pick the session back up before giving in
+            nReconnectAttempts++;
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            c.Reconnect();
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
         }
         else
         {
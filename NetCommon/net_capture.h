@@ -0,0 +1,146 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+
+namespace netp
+{
+    namespace net
+    {
+        // capture file starts with this, followed by one record per inbound message
+        struct capture_file_header
+        {
+            char sMagic[8] = {'N', 'E', 'T', 'P', 'C', 'A', 'P', '1'};
+            uint32_t nHeaderSize = 0; // sizeof(message_header<T>) of the capturing program
+            uint32_t nReserved = 0;
+        };
+
+        // precedes raw message_header<T> bytes and body of each captured message
+        struct capture_record
+        {
+            int64_t nTimestamp = 0; // nanoseconds since capture started, monotonic
+            uint32_t nConnection = 0;
+            uint32_t nBodySize = 0;
+        };
+
+        // appends captured messages to a file through a large in-memory buffer, so the
+        // asio thread only pays for a memcpy per message and a write per megabyte
+        class capture_writer
+        {
+        public:
+            capture_writer(const std::string &sPath, size_t nHeaderSize, size_t nBufferSize = 1 << 20)
+                : m_nBufferSize(nBufferSize)
+            {
+                m_pFile = std::fopen(sPath.c_str(), "wb");
+                if (!m_pFile)
+                    throw std::runtime_error("unable to open capture file " + sPath);
+
+                capture_file_header header;
+                header.nHeaderSize = uint32_t(nHeaderSize);
+                std::fwrite(&header, sizeof(header), 1, m_pFile);
+
+                m_vBuffer.reserve(m_nBufferSize);
+                m_tpStart = std::chrono::steady_clock::now();
+            }
+
+            capture_writer(const capture_writer &) = delete;
+
+            virtual ~capture_writer()
+            {
+                Flush();
+                std::fclose(m_pFile);
+            }
+
+        public:
+            template <typename T>
+            void Write(uint32_t nConnection, const message<T> &msg)
+            {
+                capture_record record;
+                record.nTimestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_tpStart).count();
+                record.nConnection = nConnection;
+                record.nBodySize = uint32_t(msg.body.size());
+
+                std::scoped_lock lock(m_muxBuffer);
+                Append(&record, sizeof(record));
+                Append(&msg.header, sizeof(message_header<T>));
+                Append(msg.body.data(), msg.body.size());
+
+                if (m_vBuffer.size() >= m_nBufferSize)
+                    FlushBuffer();
+            }
+
+            // push buffered records to disk
+            void Flush()
+            {
+                std::scoped_lock lock(m_muxBuffer);
+                FlushBuffer();
+                std::fflush(m_pFile);
+            }
+
+        private:
+            void Append(const void *pData, size_t nSize)
+            {
+                auto p = static_cast<const uint8_t *>(pData);
+                m_vBuffer.insert(m_vBuffer.end(), p, p + nSize);
+            }
+
+            void FlushBuffer()
+            {
+                if (!m_vBuffer.empty())
+                    std::fwrite(m_vBuffer.data(), 1, m_vBuffer.size(), m_pFile);
+                m_vBuffer.clear();
+            }
+
+        private:
+            std::FILE *m_pFile = nullptr;
+            std::mutex m_muxBuffer;
+            std::vector<uint8_t> m_vBuffer;
+            size_t m_nBufferSize;
+            std::chrono::steady_clock::time_point m_tpStart;
+        };
+
+        // reads messages back out of a capture file in the order they were recorded
+        template <typename T>
+        class capture_reader
+        {
+        public:
+            capture_reader(const std::string &sPath)
+            {
+                m_pFile = std::fopen(sPath.c_str(), "rb");
+                if (!m_pFile)
+                    throw std::runtime_error("unable to open capture file " + sPath);
+
+                capture_file_header header, expected;
+                if (std::fread(&header, sizeof(header), 1, m_pFile) != 1 ||
+                    std::memcmp(header.sMagic, expected.sMagic, sizeof(header.sMagic)) != 0 ||
+                    header.nHeaderSize != sizeof(message_header<T>))
+                {
+                    std::fclose(m_pFile);
+                    throw std::runtime_error("not a capture file for this message type " + sPath);
+                }
+            }
+
+            capture_reader(const capture_reader &) = delete;
+
+            virtual ~capture_reader()
+            {
+                std::fclose(m_pFile);
+            }
+
+        public:
+            // reads next message, returns false at end of file (or on a truncated final record)
+            bool Next(capture_record &record, message<T> &msg)
+            {
+                if (std::fread(&record, sizeof(record), 1, m_pFile) != 1)
+                    return false;
+                if (std::fread(&msg.header, sizeof(message_header<T>), 1, m_pFile) != 1)
+                    return false;
+
+                msg.body.resize(record.nBodySize);
+                return record.nBodySize == 0 || std::fread(msg.body.data(), 1, record.nBodySize, m_pFile) == record.nBodySize;
+            }
+
+        private:
+            std::FILE *m_pFile = nullptr;
+        };
+    }
+}
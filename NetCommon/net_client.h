@@ -9,15 +9,26 @@ namespace netp
 {
     namespace net
     {
+        // forward declare
+        template <typename T>
+        class client_swarm;
+
         template <typename T>
         class client_interface // sets up asio & connection, also acts as access point for application to talk to server
         {
         public:
             client_interface() //: m_socket(m_context)
+                : m_pOwnContext(std::make_unique<asio::io_context>()), m_context(*m_pOwnContext)
             {
                 // initialize socket with io context, so it can do stuff
             }
 
+            // client that runs on one of swarm's io_contexts & is dispatched by swarm's Update(), see net_swarm.h
+            explicit client_interface(client_swarm<T> &swarm)
+                : m_pSwarm(&swarm), m_context(swarm.NextContext())
+            {
+            }
+
             virtual ~client_interface()
             {
                 // if client is destroyed, always try to disconnect
@@ -28,22 +39,82 @@ namespace netp
             // connect to server with hostname/ip-address and port
             bool Connect(const std::string &host, const uint16_t port)
             {
+                // a swarm's context keeps running, a previous connection has to be handed back to it
+                if (m_pSwarm && m_connection)
+                    Disconnect();
+
                 try
                 {
                     // Resolve hostname/ip_address into tangible physical address
                     asio::ip::tcp::resolver resolver(m_context);
                     asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(host, std::to_string(port));
+                    m_endpoints = endpoints;
 
-                    // create connection
-                    m_connection = std::make_unique<connection<T>>(
+                    // create connection, a swarm's clients all deliver into swarm's queue
+                    m_connection = std::make_shared<connection<T>>(
                         connection<T>::owner::client,
                         m_context,
-                        asio::ip::tcp::socket(m_context), m_qMessagesIn);
+                        asio::ip::tcp::socket(m_context), m_pSwarm ? m_pSwarm->Incoming() : m_qMessagesIn);
+
+                    m_connection->SetMaxMessageSize(m_nMaxMessageSize);
+                    m_connection->SetSocketOptions(m_socketOptions);
+                    m_connection->SetTracer(m_pTracer.get());
+#ifndef _WIN32
+                    m_connection->AcceptStreams(m_sStreamDirectory, m_nMaxStreamSize);
+#endif
+#ifdef NETP_USE_TLS
+                    m_connection->SetTls(m_pTlsContext);
+#endif
+
+                    if (m_pSwarm)
+                    {
+                        m_connection->SetReadBufferSize(m_pSwarm->GetReadBufferSize());
+                        m_pSwarm->Join(m_connection.get(), this);
+                    }
 
                     // tell connection object to connect to server
                     m_connection->ConnectToServer(endpoints);
 
-                    // start context thread
+                    // start context thread, swarm's threads are already running theirs
+                    if (!m_pSwarm)
+                        thrContext = std::thread([this]()
+                                                 { m_context.run(); });
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "Client Exception: " << e.what() << '\n';
+                    return false;
+                }
+
+                return false;
+            }
+
+            // reconnect after socket failure, server resumes previous session if it still holds it
+            bool Reconnect()
+            {
+                if (!m_connection)
+                    return false;
+
+                if (m_pSwarm)
+                {
+                    // context is shared & keeps running, reconnect on its thread
+                    auto pConnection = m_connection;
+                    auto endpoints = m_endpoints;
+                    asio::post(m_context, [pConnection, endpoints]()
+                               { pConnection->ReconnectToServer(endpoints); });
+                    return true;
+                }
+
+                try
+                {
+                    // context thread may have run out of work when old socket died, restart it
+                    m_context.stop();
+                    if (thrContext.joinable())
+                        thrContext.join();
+                    m_context.restart();
+
+                    m_connection->ReconnectToServer(m_endpoints);
+
                     thrContext = std::thread([this]()
                                              { m_context.run(); });
                 }
@@ -53,6 +124,57 @@ namespace netp
                     return false;
                 }
 
+                return true;
+            }
+
+            // largest message server may send, takes effect on next Connect()
+            void SetMaxMessageSize(uint32_t nBytes)
+            {
+                m_nMaxMessageSize = nBytes;
+            }
+
+            // nodelay, buffer sizes etc., takes effect on next Connect()
+            void SetSocketOptions(const socket_options &options)
+            {
+                m_socketOptions = options;
+            }
+
+#ifndef _WIN32
+            // store files the server streams (server_interface::StreamFileToClient()) in sDirectory, each
+            // arrives as a message holding its name & a stream_complete. takes effect on next Connect()
+            void AcceptStreams(const std::string &sDirectory, uint64_t nMaxBytes = uint64_t(4) * 1024 * 1024 * 1024)
+            {
+                m_sStreamDirectory = sDirectory;
+                m_nMaxStreamSize = nMaxBytes;
+            }
+#endif
+
+#ifdef NETP_USE_TLS
+            // talk TLS to server from next Connect() on. context may be shared by many clients, they then
+            // also share its session ticket & skip full handshakes after the first
+            void EnableTls(std::shared_ptr<tls_context> pContext)
+            {
+                m_pTlsContext = std::move(pContext);
+            }
+#endif
+
+            // trace 1 in nSampleEvery messages received & sent, see GetTracer(). takes effect on next Connect()
+            void EnableTracing(uint32_t nSampleEvery = 64)
+            {
+                m_pTracer = std::make_unique<message_tracer>(nSampleEvery);
+            }
+
+            // nullptr unless EnableTracing() was called
+            message_tracer *GetTracer()
+            {
+                return m_pTracer.get();
+            }
+
+            // true if the last (re)connect picked up the previous session, false if server started a new one
+            bool WasResumed()
+            {
+                if (m_connection)
+                    return m_connection->WasResumed();
                 return false;
             }
 
@@ -65,14 +187,25 @@ namespace netp
                     m_connection->Disconnect();
                 }
 
+                if (m_pSwarm)
+                {
+                    // context is shared & keeps running, handlers still queued on it hold the connection until they run
+                    if (m_connection)
+                        m_pSwarm->Leave(m_connection.get());
+                    m_connection.reset();
+                    return;
+                }
+
                 // stop asio context
                 m_context.stop();
                 // stop thread
                 if (thrContext.joinable())
                     thrContext.join();
 
-                // destroy connection object
-                m_connection.release();
+                // destroy connection object, context is stopped so none of its handlers can run any more
+                if (m_connection)
+                    m_connection->Close();
+                m_connection.reset();
             }
 
             // check if client is connected to server
@@ -89,17 +222,95 @@ namespace netp
                 return m_qMessagesIn;
             }
 
+            // client tick - dispatch up to nMaxMessages to OnMessage, sleeping up to waitFor
+            // if nothing has arrived yet. returns number of messages handled
+            size_t Update(size_t nMaxMessages = -1, std::chrono::milliseconds waitFor = std::chrono::milliseconds(0))
+            {
+                if (waitFor.count() > 0)
+                    m_qMessagesIn.wait_for(waitFor);
+
+                return DispatchMessages(nMaxMessages);
+            }
+
+            // same as server, bWait blocks until at least one message has arrived
+            size_t Update(size_t nMaxMessages, bool bWait)
+            {
+                if (bWait)
+                    m_qMessagesIn.wait();
+
+                return DispatchMessages(nMaxMessages);
+            }
+
+        protected:
+            // called for every message from server during Update()
+            virtual void OnMessage(message<T> &msg)
+            {
+            }
+
+        private:
+            friend class client_swarm<T>;
+
+            // hand one received message to OnMessage, recording its trace stamps if it was sampled
+            void DispatchMessage(owned_message<T> &msg, int64_t nDequeue)
+            {
+                if (msg.trace.nRead != 0 && m_pTracer)
+                {
+                    int64_t nHandlerStart = TraceNow();
+                    OnMessage(msg.msg);
+                    m_pTracer->RecordInbound(msg.trace, nDequeue, nHandlerStart, TraceNow());
+                }
+                else
+                {
+                    OnMessage(msg.msg);
+                }
+            }
+
+            size_t DispatchMessages(size_t nMaxMessages)
+            {
+                // take messages in batches so the queue lock is not taken per message
+                size_t nMessageCount = 0;
+                while (nMessageCount < nMaxMessages && m_qMessagesIn.drain(m_deqBatch, std::min<size_t>(nMaxMessages - nMessageCount, 64)) > 0)
+                {
+                    int64_t nDequeue = m_pTracer ? TraceNow() : 0;
+                    while (!m_deqBatch.empty())
+                    {
+                        DispatchMessage(m_deqBatch.front(), nDequeue);
+                        m_deqBatch.pop_front();
+                        nMessageCount++;
+                    }
+                }
+                return nMessageCount;
+            }
+
         protected:
+            // context of a standalone client, nullptr for a swarm's client which runs on one of swarm's
+            std::unique_ptr<asio::io_context> m_pOwnContext;
+            client_swarm<T> *m_pSwarm = nullptr;
             // asio context handles data transfer
-            asio::io_context m_context;
+            asio::io_context &m_context;
             // needs thread of its own to execute its work commands
             std::thread thrContext;
             // the client has a single instance of a "connection" object, which handels data transfer
-            std::unique_ptr<connection<T>> m_connection;
+            std::shared_ptr<connection<T>> m_connection;
+            // where to reconnect to
+            asio::ip::tcp::resolver::results_type m_endpoints;
+            uint32_t m_nMaxMessageSize = 16 * 1024 * 1024;
+            socket_options m_socketOptions;
+            std::unique_ptr<message_tracer> m_pTracer;
+#ifndef _WIN32
+            std::string m_sStreamDirectory;
+            uint64_t m_nMaxStreamSize = 0;
+#endif
+#ifdef NETP_USE_TLS
+            std::shared_ptr<tls_context> m_pTlsContext;
+#endif
 
         private:
             // thread safe queue of incoming messages from server
             tsqueue<owned_message<T>> m_qMessagesIn;
+
+            // messages taken off m_qMessagesIn awaiting dispatch, reused across updates
+            std::deque<owned_message<T>> m_deqBatch;
         };
     }
 }
\ No newline at end of file
@@ -1,15 +1,29 @@
 #pragma once
 
 #include <memory>
+#include <new>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <deque>
 #include <optional>
+#include <future>
 #include <vector>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <iterator>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <stdexcept>
 // #include <ncurses.h>
 #include <unistd.h>
 
@@ -17,7 +31,46 @@
 #define _WIN32_WINNT 0x0A00
 #endif
 
+// build with -DNETP_USE_IO_URING (and link -luring, asio 1.21 or later, linux 5.10 or later) to run every socket
+// on asio's io_uring backend instead of epoll: reads & writes are submitted to a ring & their completions reaped
+// in batches. connections already read into a 64KB buffer & gather queued frames into one write, see net_connection.h
+#if defined(NETP_USE_IO_URING) && defined(__linux__)
+#define ASIO_HAS_IO_URING
+#define ASIO_DISABLE_EPOLL
+#endif
+
 #define ASIO_STANDALONE
 #include <asio.hpp>
 #include <asio/ts/buffer.hpp>
 #include <asio/ts/internet.hpp>
+
+#if defined(NETP_USE_IO_URING) && defined(ASIO_VERSION) && ASIO_VERSION < 102100
+#error NETP_USE_IO_URING needs asio 1.21 or later
+#endif
+
+// build with -DNETP_USE_TLS (and link -lssl -lcrypto, openssl 3) to offer TLS 1.3 on connections, see net_tls.h
+#ifdef NETP_USE_TLS
+#include <asio/ssl.hpp>
+#endif
+
+namespace netp
+{
+    namespace net
+    {
+        // library status lines, eg. "[SERVER] New Connection", are on unless turned off with SetLogging(false),
+        // eg. by a benchmark printing its own results. safe from any thread, unlike swapping std::cout's buffer
+        inline std::atomic<bool> g_bLogging{true};
+
+        inline void SetLogging(bool bLogging)
+        {
+            g_bLogging.store(bLogging, std::memory_order_relaxed);
+        }
+
+        // stream for status lines: std::cout, or one per thread that discards everything while logging is off
+        inline std::ostream &Log()
+        {
+            thread_local std::ostream discard(nullptr);
+            return g_bLogging.load(std::memory_order_relaxed) ? std::cout : discard;
+        }
+    }
+}
@@ -3,6 +3,14 @@
 #include "net_common.h"
 #include "net_tsqueue.h"
 #include "net_message.h"
+#include "net_lanes.h"
+#include "net_capture.h"
+#include "net_ratelimit.h"
+#include "net_handoff.h"
+#include "net_sockopt.h"
+#include "net_trace.h"
+#include "net_tls.h"
+#include "net_stream.h"
 
 namespace netp
 {
@@ -12,6 +20,21 @@ namespace netp
         template <typename T>
         class server_interface;
 
+        // sent by client once it has solved the validation puzzle, a non-zero token asks to resume that session
+        struct session_request
+        {
+            uint64_t nValidation = 0;
+            uint64_t nToken = 0;
+            uint64_t nLastSequence = 0;
+        };
+
+        // server's answer to session_request, nResumed is 0 if client was given a fresh session
+        struct session_reply
+        {
+            uint64_t nToken = 0;
+            uint64_t nResumed = 0;
+        };
+
         template <typename T>
         class connection : public std::enable_shared_from_this<connection<T>>
         {
@@ -23,10 +46,13 @@ namespace netp
             };
 
             connection(owner parent, asio::io_context &asioContext, asio::ip::tcp::socket socket, tsqueue<owned_message<T>> &qIn)
-                : m_asioContext(asioContext), m_socket(std::move(socket)), m_qMessagesIn(qIn)
+                : m_asioContext(asioContext), m_socket(std::move(socket)), m_qMessagesIn(qIn), m_timerRead(asioContext)
             {
                 m_nOwnerType = parent;
 
+                // a fresh connection counts as active, idle timers start from now
+                m_tpLastRead = m_tpLastWrite = std::chrono::steady_clock::now();
+
                 // construct validatoin check data
                 if (m_nOwnerType == owner::server)
                 {
@@ -53,6 +79,144 @@ namespace netp
                 return id;
             }
 
+            // time data was last received from / sent to remote, used by idle & heartbeat timers. asio thread.
+            // while rate limiter holds reads back the remote is not idle, its data just waits in the socket
+            std::chrono::steady_clock::time_point GetLastReadTime() const
+            {
+                return m_bReadPaused ? std::chrono::steady_clock::now() : m_tpLastRead;
+            }
+
+            std::chrono::steady_clock::time_point GetLastWriteTime() const
+            {
+                return m_tpLastWrite;
+            }
+
+            // flags connection as removed from its owner, returns true only for the first caller
+            // so OnClientDisconnect fires exactly once no matter which path detected it
+            bool MarkRemoved()
+            {
+                return !m_bRemoved.exchange(true);
+            }
+
+            bool IsRemoved() const
+            {
+                return m_bRemoved;
+            }
+
+            uint64_t GetSessionToken() const
+            {
+                return m_nSessionToken;
+            }
+
+            // client only - true if last handshake resumed the previous session rather than starting a new one
+            bool WasResumed() const
+            {
+                return m_bResumed;
+            }
+
+            // server only - socket failed but session is held open waiting for client to resume
+            bool IsSuspended() const
+            {
+                return m_bSuspended;
+            }
+
+            std::chrono::steady_clock::time_point GetSuspendedTime() const
+            {
+                return m_tpSuspended;
+            }
+
+            // server only - record every message received into capture, nullptr stops recording
+            void SetCapture(capture_writer *pCapture)
+            {
+                m_pCapture = pCapture;
+            }
+
+            // stamp sampled messages through the pipeline into pTracer's histograms, nullptr stops tracing.
+            // set before connecting, tracer must outlive connection
+            void SetTracer(message_tracer *pTracer)
+            {
+                m_pTracer = pTracer;
+            }
+
+            // receive buffer every read lands in, frames that do not fit are read straight into their message.
+            // set before connecting
+            void SetReadBufferSize(size_t nBytes)
+            {
+                // a chunk's headers & name have to fit
+                m_vReadBuffer.assign(std::max<size_t>(nBytes, 1024), 0);
+                m_vReadBuffer.shrink_to_fit();
+            }
+
+            // largest message remote may send, checked against frame headers before anything is allocated
+            void SetMaxMessageSize(uint32_t nBytes)
+            {
+                m_nMaxMessageSize = nBytes;
+            }
+
+            // server only - throttle what this client may send, enforced before messages reach the game thread
+            void SetRateLimits(std::shared_ptr<const rate_limits<T>> pLimits)
+            {
+                if (pLimits)
+                    m_limiter.Configure(pLimits);
+            }
+
+            // messages discarded by limit_action::drop
+            uint64_t GetDroppedMessages() const
+            {
+                return m_nDropped;
+            }
+
+            // settings for socket, applied now if it is open & again whenever a connect opens a new one.
+            // returns false if the open socket refused some of them
+            bool SetSocketOptions(const socket_options &options)
+            {
+                m_socketOptions = options;
+                if (m_socket.is_open())
+                    return ApplySocketOptions(m_socket, m_socketOptions);
+                return true;
+            }
+
+#ifdef NETP_USE_TLS
+            // run connection over TLS from the next (re)connect / accept on, role comes from the context
+            void SetTls(std::shared_ptr<tls_context> pContext)
+            {
+                m_pTlsContext = std::move(pContext);
+            }
+
+            bool IsTls() const
+            {
+                return m_pTls != nullptr;
+            }
+
+            // true if kernel encrypts what this connection sends
+            bool IsKernelTls() const
+            {
+                return m_bKernelTx;
+            }
+#endif
+
+            // server only - keep the last nMessages sent so a client resuming after a socket failure can be caught up
+            void EnableResume(size_t nMessages)
+            {
+                m_nReplayLimit = nMessages;
+            }
+
+#ifndef _WIN32
+            // store files remote streams into sDirectory, none may be larger than nMaxBytes. without
+            // a directory any stream is refused & closes the connection. set before connecting
+            void AcceptStreams(const std::string &sDirectory, uint64_t nMaxBytes)
+            {
+                m_sStreamDirectory = sDirectory;
+                m_nMaxStreamSize = nMaxBytes;
+            }
+
+            // bytes of file data per chunk, lanes get a write of their own between chunks
+            void SetChunkSize(size_t nBytes)
+            {
+                m_nChunkSize = std::clamp<size_t>(nBytes, 1, STREAM_CHUNK_LIMIT);
+            }
+#endif
+
         public:
             void ConnectToClient(netp::net::server_interface<T> *server, uint32_t uid = 0)
             {
@@ -61,6 +225,17 @@ namespace netp
                     if (m_socket.is_open())
                     {
                         id = uid;
+#ifdef NETP_USE_TLS
+                        if (m_pTlsContext)
+                        {
+                            // encrypt before anything is said, validation then happens inside TLS
+                            StartTls(asio::ssl::stream_base::server, [this, server]()
+                                     {
+                                         WriteValidation();
+                                         ReadValidation(server); });
+                            return;
+                        }
+#endif
                         // ReadHeader();
                         // client attempt to connect to server, validate client, write out handshake data
                         WriteValidation();
@@ -77,10 +252,20 @@ namespace netp
                 {
                     // request asio to connect to endpoint
                     asio::async_connect(m_socket, endpoints,
-                                        [this](std::error_code ec, asio::ip::tcp::endpoint endpoint)
+                                        [this, self = this->shared_from_this()](std::error_code ec, asio::ip::tcp::endpoint endpoint)
                                         {
                                             if (!ec)
                                             {
+                                                ApplySocketOptions(m_socket, m_socketOptions);
+#ifdef NETP_USE_TLS
+                                                if (m_pTlsContext)
+                                                {
+                                                    StartTls(asio::ssl::stream_base::client, [this]()
+                                                             { ReadValidation(); });
+                                                    return;
+                                                }
+#endif
+
                                                 // ReadHeader();
                                                 // First validate a packet, wait and respond
                                                 ReadValidation();
@@ -88,138 +273,930 @@ namespace netp
                                         });
                 }
             }
+
+            // client only - open a fresh socket, the handshake offers the current session token for resumption
+            void ReconnectToServer(const asio::ip::tcp::resolver::results_type &endpoints)
+            {
+                if (m_nOwnerType == owner::client)
+                {
+                    if (m_socket.is_open())
+                        m_socket.close();
+
+                    m_socket = asio::ip::tcp::socket(m_asioContext);
+                    m_bEstablished = false;
+
+                    // half received messages died with the old socket, half sent ones start over
+                    for (auto &partial : m_msgPartialIn)
+                        partial = {};
+                    m_qMessagesOut.Restart();
+                    RestartStreams();
+                    ConnectToServer(endpoints);
+                }
+            }
+
+            // server only - take over socket (& TLS session) of a reconnecting client from the connection it arrived
+            // on. everything the client has not fully received (after nLastSequence) is queued again, returns false
+            // if that is no longer possible
+            bool Resume(connection &from, uint64_t nLastSequence)
+            {
+                if (!m_bSuspended)
+                    return false;
+
+                uint64_t nOldestHeld = m_nSequenceOut - m_deqReplay.size();
+                if (nLastSequence < nOldestHeld || nLastSequence > m_nSequenceOut)
+                    return false;
+
+                // client has thrown away any fragments it had, requeue in original order
+                // in front of anything sent while suspended
+                m_qMessagesOut.Restart();
+                while (m_nSequenceOut > nLastSequence)
+                {
+                    m_qMessagesOut.push_front(std::move(m_deqReplay.back()));
+                    m_deqReplay.pop_back();
+                    m_nSequenceOut--;
+                }
+
+                m_socket = std::move(from.m_socket);
+#ifdef NETP_USE_TLS
+                m_pTls = std::move(from.m_pTls);
+                m_bKernelTx = from.m_bKernelTx;
+                if (m_pTls)
+                    m_pTls->next_layer().Rebind(&m_socket);
+#endif
+                m_bSuspended = false;
+                m_bReadingBody = false;
+                for (auto &partial : m_msgPartialIn)
+                    partial = {};
+                RestartStreams();
+                m_tpLastRead = m_tpLastWrite = std::chrono::steady_clock::now();
+
+                Log() << "[" << id << "] Session Resumed\n";
+                WriteSessionReply(true);
+                return true;
+            }
+
+            // close for good on asio thread, safe from any thread
             void Disconnect()
             {
-                if (IsConnected())
-                    asio::post(m_asioContext, [this]()
-                               { m_socket.close(); });
+                asio::post(m_asioContext, [this, self = this->shared_from_this()]()
+                           { Close(); });
             }
-            bool IsConnected() const
+
+            // asio thread, or once context has stopped - close for good. a TLS session ended on purpose is
+            // marked shut down, openssl would otherwise drop it from the cache & it could not be resumed
+            void Close()
             {
-                return m_socket.is_open();
+                m_bSuspended = false;
+                m_bEstablished = false;
+                m_bReadPaused = false;
+                m_timerRead.cancel();
+#ifdef NETP_USE_TLS
+                if (m_pTls)
+                    SSL_set_shutdown(m_pTls->native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+#endif
+                asio::error_code ec;
+                m_socket.close(ec);
             }
 
+            // virtual so stand-ins without a socket, eg. replayed clients, can count as connected
+            virtual bool IsConnected() const
+            {
+                return m_socket.is_open() || m_bSuspended;
+            }
+
+            // server only, asio thread - stop parsing input, eg. while draining or before a handoff.
+            // bytes still arriving are kept in the receive buffer unparsed
+            void StopReading()
+            {
+                m_bReadStopped = true;
+            }
+
+            // asio thread - true while messages are queued for a socket that can still take them
+            bool HasPendingWrites() const
+            {
+                return m_socket.is_open() && (!m_qMessagesOut.empty() || HasStreamsOut());
+            }
+
+            // server only, asio thread - end of stream after everything already written. input is discarded until
+            // remote closes too, closing with unread data would reset the connection & lose what is still in flight
+            void Shutdown()
+            {
+                m_bSuspended = false;
+                m_bReadStopped = true;
+                m_timerRead.cancel();
+                if (!m_socket.is_open())
+                    return;
+
+                asio::error_code ec;
+                m_socket.cancel(ec);
+                m_socket.shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+                DiscardInput();
+            }
+
+            // server only, asio thread - cancel outstanding reads ahead of Detach(), so data read
+            // up to now lands in the receive buffer before it is handed over
+            void CancelReads()
+            {
+                m_bReadStopped = true;
+                m_timerRead.cancel();
+                if (m_socket.is_open())
+                {
+                    asio::error_code ec;
+                    m_socket.cancel(ec);
+                }
+            }
+
+#ifndef _WIN32
+            // server only, asio thread - give up socket so another process can carry on with it, see Adopt().
+            // returns its descriptor (now owned by caller), or -1 if the connection is mid-handshake or
+            // mid-message and cannot be carried over - it is closed instead & its client has to reconnect
+            int Detach(handoff_record &record, std::vector<uint8_t> &vLeftover)
+            {
+                bool bPartial = m_bReadingBody || m_bReadPaused;
+                for (auto &partial : m_msgPartialIn)
+                    bPartial = bPartial || !partial.body.empty();
+                bPartial = bPartial || HasStreamsOut() || !m_mapStreamsIn.empty();
+#ifdef NETP_USE_TLS
+                // session keys live in this process's openssl, the next process could not carry on with them
+                bPartial = bPartial || m_pTls;
+#endif
+
+                if (!m_bEstablished || !m_socket.is_open() || !m_qMessagesOut.empty() || bPartial)
+                {
+                    asio::error_code ec;
+                    m_socket.close(ec);
+                    return -1;
+                }
+
+                record.nID = id;
+                record.nSessionToken = m_nSessionToken;
+                record.nSequenceOut = m_nSequenceOut;
+                record.nLeftover = uint32_t(m_nReadEnd - m_nReadStart);
+                vLeftover.assign(m_vReadBuffer.begin() + m_nReadStart, m_vReadBuffer.begin() + m_nReadEnd);
+
+                m_bEstablished = false;
+                asio::error_code ec;
+                return m_socket.release(ec);
+            }
+
+            // server only - continue a connection detached by a previous server process. socket was given to
+            // constructor, pLeftover holds record.nLeftover bytes it had received but not parsed
+            void Adopt(const handoff_record &record, const uint8_t *pLeftover)
+            {
+                id = record.nID;
+                m_nSessionToken = record.nSessionToken;
+                m_nSequenceOut = record.nSequenceOut;
+
+                std::memcpy(m_vReadBuffer.data(), pLeftover, std::min<size_t>(record.nLeftover, m_vReadBuffer.size()));
+                m_nReadStart = 0;
+                m_nReadEnd = std::min<size_t>(record.nLeftover, m_vReadBuffer.size());
+                m_bEstablished = true;
+
+                asio::post(m_asioContext, [this, self = this->shared_from_this()]()
+                                          { ProcessReadBuffer(); });
+            }
+#endif
+
         public:
-            void Send(const message<T> &msg)
+            void Send(const message<T> &msg, priority nPriority = priority::normal)
             {
+                int64_t nTraced = m_pTracer && m_pTracer->SampleOutbound() ? TraceNow() : 0;
                 asio::post(m_asioContext,
-                           [this, msg]()
+                           [this, self = this->shared_from_this(), msg, nPriority, nTraced]()
                            {
-                               bool bWritingMessage = !m_qMessagesOut.empty();
-                               m_qMessagesOut.push_back(msg);
-                               if (!bWritingMessage)
-                               {
-                                   WriteHeader();
-                               }
+                               // nobody will ever read it, eg. remote is gone or connection is a replay stand-in
+                               if (m_nOwnerType == owner::server && !m_socket.is_open() && !m_bSuspended)
+                                   return;
+
+                               // before handshake completes (or while suspended) messages just wait in queue
+                               m_qMessagesOut.push_back(msg, nPriority, nTraced);
+                               WriteNext();
                            });
             }
 
+#ifndef _WIN32
+            // stream file at sPath to remote in chunks, interleaved with messages & without loading it into memory.
+            // remote stores it as sName (default: file name of sPath) in its stream directory & gets a message with id
+            // holding the name & a stream_complete once all of it is in. safe from any thread, streams go one after
+            // the other. returns stream number, 0 if the file cannot be opened
+            uint32_t SendFile(T nID, const std::string &sPath, std::string sName = {})
+            {
+                if (sName.empty())
+                    sName = sPath.substr(sPath.find_last_of('/') + 1);
+                if (!IsSafeStreamName(sName))
+                    return 0;
+
+                uint32_t nStream = ++m_nStreamCounter;
+                auto pFile = std::make_shared<file_stream_out>(nStream, sPath, sName);
+                if (!pFile->IsOpen())
+                    return 0;
+
+                asio::post(m_asioContext,
+                           [this, self = this->shared_from_this(), nID, pFile]()
+                           {
+                               if (m_nOwnerType == owner::server && !m_socket.is_open() && !m_bSuspended)
+                                   return;
+
+                               m_deqStreamsOut.push_back({nID, pFile});
+                               WriteNext();
+                           });
+                return nStream;
+            }
+#endif
+
+            // relative share of frames given to a lane while several have data queued
+            void SetLaneWeight(priority nPriority, int32_t nWeight)
+            {
+                asio::post(m_asioContext, [this, self = this->shared_from_this(), nPriority, nWeight]()
+                                          { m_qMessagesOut.SetWeight(nPriority, nWeight); });
+            }
+
         private:
-            // ASYNC - prime context ready to read message header
-            void ReadHeader()
+            // ASYNC - read whatever has arrived into the receive buffer, one completion can carry many frames
+            void ReadSome()
             {
-                asio::async_read(m_socket, asio::buffer(&m_msgTemporaryIn.header, sizeof(message_header<T>)),
-                                 [this](std::error_code ec, std::size_t length)
-                                 {
-                                     if (!ec)
-                                     {
+                // shift unparsed tail of last read to front so buffer is reused, never reallocated
+                if (m_nReadStart > 0)
+                {
+                    std::memmove(m_vReadBuffer.data(), m_vReadBuffer.data() + m_nReadStart, m_nReadEnd - m_nReadStart);
+                    m_nReadEnd -= m_nReadStart;
+                    m_nReadStart = 0;
+                }
 
-                                         if (m_msgTemporaryIn.header.size > 0)
-                                         {
-                                             m_msgTemporaryIn.body.resize(m_msgTemporaryIn.header.size);
-                                             ReadBody();
-                                         }
-                                         else
+                AsyncReadSome(asio::buffer(m_vReadBuffer.data() + m_nReadEnd, m_vReadBuffer.size() - m_nReadEnd),
+                              [this, self = this->shared_from_this()](std::error_code ec, std::size_t length)
+                              {
+                                  if (!ec)
+                                  {
+                                      m_tpLastRead = std::chrono::steady_clock::now();
+                                      m_nReadEnd += length;
+                                      if (m_socketOptions.bQuickAck)
+                                          RearmQuickAck(m_socket);
+                                      ProcessReadBuffer();
+                                  }
+                                  else
+                                  {
+                                      if (!m_bReadStopped)
+                                          Log() << "[" << id << "] Read Fail.\n";
+                                      OnSocketError(ec);
+                                  }
+                              });
+            }
+
+            // socket I/O goes through TLS when it is on. with kernel TLS, writes go to socket & the kernel encrypts them
+            template <typename MutableBuffers, typename Handler>
+            void AsyncReadSome(const MutableBuffers &buffers, Handler &&handler)
+            {
+#ifdef NETP_USE_TLS
+                if (m_pTls)
+                {
+                    m_pTls->async_read_some(buffers, std::forward<Handler>(handler));
+                    return;
+                }
+#endif
+                m_socket.async_read_some(buffers, std::forward<Handler>(handler));
+            }
+
+            template <typename MutableBuffers, typename Handler>
+            void AsyncRead(const MutableBuffers &buffers, Handler &&handler)
+            {
+#ifdef NETP_USE_TLS
+                if (m_pTls)
+                {
+                    asio::async_read(*m_pTls, buffers, std::forward<Handler>(handler));
+                    return;
+                }
+#endif
+                asio::async_read(m_socket, buffers, std::forward<Handler>(handler));
+            }
+
+            template <typename ConstBuffers, typename Handler>
+            void AsyncWrite(const ConstBuffers &buffers, Handler &&handler)
+            {
+#ifdef NETP_USE_TLS
+                if (m_pTls && !m_bKernelTx)
+                {
+                    asio::async_write(*m_pTls, buffers, std::forward<Handler>(handler));
+                    return;
+                }
+#endif
+                asio::async_write(m_socket, buffers, std::forward<Handler>(handler));
+            }
+
+#ifdef NETP_USE_TLS
+            // ASYNC - new TLS session on m_socket, then() once it is established. a client offers the context's
+            // last session ticket so the server can skip the full handshake
+            template <typename Then>
+            void StartTls(asio::ssl::stream_base::handshake_type type, Then then)
+            {
+                m_pTls = std::make_unique<tls_stream>(tls_socket_ref(&m_socket), m_pTlsContext->native());
+                m_bKernelTx = false;
+                m_tlsSecrets = {};
+
+                SSL *pSSL = m_pTls->native_handle();
+                SSL_set_ex_data(pSSL, tls_context::SecretsIndex(), &m_tlsSecrets);
+                if (type == asio::ssl::stream_base::client)
+                    m_pTlsContext->ResumeSession(pSSL);
+
+                m_pTls->async_handshake(type,
+                                        [this, self = this->shared_from_this(), then](std::error_code ec)
+                                        {
+                                            SSL *pSSL = m_pTls->native_handle();
+                                            SSL_set_ex_data(pSSL, tls_context::SecretsIndex(), nullptr);
+                                            if (!ec)
+                                            {
+                                                m_pTlsContext->CountHandshake(pSSL);
+                                                if (m_pTlsContext->KernelTls())
+                                                    m_bKernelTx = EnableKernelTlsTx(pSSL, m_socket, m_pTlsContext->Role(), m_tlsSecrets);
+
+                                                for (auto *pSecret : {&m_tlsSecrets.vClientTraffic, &m_tlsSecrets.vServerTraffic})
+                                                {
+                                                    OPENSSL_cleanse(pSecret->data(), pSecret->size());
+                                                    pSecret->clear();
+                                                }
+                                                then();
+                                            }
+                                            else
+                                            {
+                                                Log() << "[" << id << "] TLS Handshake Fail.\n";
+                                                OnSocketError(ec);
+                                            }
+                                        });
+            }
+#endif
+
+            // ASYNC - read & throw away until remote closes its side
+            void DiscardInput()
+            {
+                m_socket.async_read_some(asio::buffer(m_vReadBuffer.data(), m_vReadBuffer.size()),
+                                         [this, self = this->shared_from_this()](std::error_code ec, std::size_t length)
                                          {
-                                             AddToIncomingMessageQueue();
-                                         }
-                                     }
-                                     else
-                                     {
-                                         std::cout << "[" << id << "] Read Header Fail.\n";
-                                         m_socket.close();
-                                     }
-                                 });
+                                             if (!ec)
+                                                 DiscardInput();
+                                             else if (ec != asio::error::operation_aborted)
+                                                 m_socket.close();
+                                         });
             }
 
-            void ReadBody()
+            // hand every complete frame in receive buffer to the game, then go back to reading
+            void ProcessReadBuffer()
             {
-                asio::async_read(m_socket, asio::buffer(m_msgTemporaryIn.body.data(), m_msgTemporaryIn.body.size()),
-                                 [this](std::error_code ec, std::size_t length)
-                                 {
-                                     if (!ec)
-                                     {
-                                         AddToIncomingMessageQueue();
-                                     }
-                                     else
-                                     {
-                                         std::cout << "[" << id << "] Read Body Fail.\n";
-                                         m_socket.close();
-                                     }
-                                 });
+                if (m_bReadStopped)
+                    return;
+
+                while (m_nReadEnd - m_nReadStart >= sizeof(message_header<T>))
+                {
+                    std::memcpy(&m_msgTemporaryIn.header, m_vReadBuffer.data() + m_nReadStart, sizeof(message_header<T>));
+
+                    uint32_t nSize = m_msgTemporaryIn.header.size;
+                    if (!IsValidFrame(nSize))
+                    {
+                        Log() << "[" << id << "] Bad Frame.\n";
+                        m_socket.close();
+                        return;
+                    }
+
+                    size_t nBody = nSize & frame::size_mask;
+                    size_t nAvailable = m_nReadEnd - m_nReadStart - sizeof(message_header<T>);
+                    uint8_t *pBody = nullptr;
+#ifndef _WIN32
+                    if (nSize & frame::chunk)
+                    {
+                        // chunk header & name must be in buffer to know where data goes, data itself
+                        // is then copied or read straight into the stream's mapped file
+                        if (nAvailable < sizeof(chunk_header))
+                            break;
+
+                        std::memcpy(&m_chunkIn, m_vReadBuffer.data() + m_nReadStart + sizeof(message_header<T>), sizeof(chunk_header));
+                        size_t nPrefix = sizeof(chunk_header) + m_chunkIn.nNameLength;
+                        if (m_chunkIn.nNameLength > STREAM_NAME_LIMIT || nPrefix > nBody)
+                        {
+                            Log() << "[" << id << "] Bad Frame.\n";
+                            m_socket.close();
+                            return;
+                        }
+                        if (nAvailable < nPrefix)
+                            break;
+
+                        m_nReadStart += sizeof(message_header<T>);
+                        if (!BeginChunk(m_vReadBuffer.data() + m_nReadStart + sizeof(chunk_header), nBody - nPrefix, pBody))
+                            return;
+
+                        m_nReadStart += nPrefix;
+                        nAvailable -= nPrefix;
+                        nBody -= nPrefix;
+                    }
+                    else
+#endif
+                    {
+                        if (IncomingMessageSize(nSize) > m_nMaxMessageSize)
+                        {
+                            Log() << "[" << id << "] Message Too Large.\n";
+                            m_socket.close();
+                            return;
+                        }
+
+                        if (nAvailable < nBody && sizeof(message_header<T>) + nBody <= m_vReadBuffer.size())
+                        {
+                            // rest of frame will fit in buffer, wait for it
+                            break;
+                        }
+
+                        m_nReadStart += sizeof(message_header<T>);
+                        pBody = PrepareFrameBody(nBody);
+                    }
+
+                    size_t nCopy = std::min(nAvailable, nBody);
+                    if (nCopy > 0)
+                        std::memcpy(pBody, m_vReadBuffer.data() + m_nReadStart, nCopy);
+                    m_nReadStart += nCopy;
+
+                    if (nCopy < nBody)
+                    {
+                        // frame bigger than buffer, read remainder straight into its destination
+                        ReadBody(pBody + nCopy, nBody - nCopy);
+                        return;
+                    }
+
+                    if (!OnFrameRead())
+                        return;
+                }
+
+                ReadSome();
             }
 
-            // ASYNC - prime context to write message header
-            void WriteHeader()
+            void ReadBody(uint8_t *pData, size_t nSize)
             {
-                asio::async_write(m_socket, asio::buffer(&m_qMessagesOut.front().header, sizeof(message_header<T>)),
-                                  [this](std::error_code ec, std::size_t length)
-                                  {
-                                      if (!ec)
-                                      {
-                                          if (m_qMessagesOut.front().body.size() > 0)
-                                          {
-                                              WriteBody();
-                                          }
-                                          else
-                                          {
-                                              m_qMessagesOut.pop_front();
-                                              if (!m_qMessagesOut.empty())
-                                              {
-                                                  WriteHeader();
-                                              }
-                                          }
-                                      }
-                                      else
-                                      {
-                                          std::cout << "[" << id << "] Write Header Fail.\n";
-                                          m_socket.close();
-                                      }
-                                  });
+                m_bReadingBody = true;
+                AsyncRead(asio::buffer(pData, nSize),
+                          [this, self = this->shared_from_this()](std::error_code ec, std::size_t length)
+                          {
+                              // a cancelled read leaves the flag set, the frame is still half consumed & Detach() must see it
+                              if (!ec)
+                              {
+                                  m_bReadingBody = false;
+                                  m_tpLastRead = std::chrono::steady_clock::now();
+                                  if (OnFrameRead())
+                                      ProcessReadBuffer();
+                              }
+                              else
+                              {
+                                  Log() << "[" << id << "] Read Body Fail.\n";
+                                  OnSocketError(ec);
+                              }
+                          });
             }
 
-            void WriteBody()
+            // whole messages carry no flags, fragments must name a real lane, chunks carry nothing else
+            bool IsValidFrame(uint32_t nSize) const
             {
-                asio::async_write(m_socket, asio::buffer(m_qMessagesOut.front().body.data(), m_qMessagesOut.front().body.size()),
-                                  [this](std::error_code ec, std::size_t length)
-                                  {
-                                      if (!ec)
-                                      {
-                                          m_qMessagesOut.pop_front();
+                if (nSize & frame::chunk)
+                {
+#ifndef _WIN32
+                    return (nSize & ~(frame::chunk | frame::size_mask)) == 0;
+#else
+                    return false;
+#endif
+                }
+                if (!(nSize & frame::fragment))
+                    return (nSize & ~frame::size_mask) == 0;
+                return ((nSize & frame::lane_mask) >> frame::lane_shift) < PRIORITY_LANES;
+            }
 
-                                          if (!m_qMessagesOut.empty())
-                                          {
-                                              WriteHeader();
-                                          }
-                                      }
-                                      else
-                                      {
-                                          std::cout << "[" << id << "] Write Body Fail.\n";
-                                          m_socket.close();
-                                      }
-                                  }
+            // size the message a frame belongs to will have once the frame is read
+            size_t IncomingMessageSize(uint32_t nSize) const
+            {
+                size_t nBody = nSize & frame::size_mask;
+                if (nSize & frame::fragment)
+                    nBody += m_msgPartialIn[(nSize & frame::lane_mask) >> frame::lane_shift].body.size();
+                return nBody;
+            }
 
-                );
+            // make room for body of frame described by m_msgTemporaryIn.header, returns where it goes
+            uint8_t *PrepareFrameBody(size_t nBody)
+            {
+                uint32_t nSize = m_msgTemporaryIn.header.size;
+                if (nSize & frame::fragment)
+                {
+                    // append fragment to the message being rebuilt for its lane
+                    auto &partial = m_msgPartialIn[(nSize & frame::lane_mask) >> frame::lane_shift];
+                    size_t nOffset = partial.body.size();
+                    partial.body.resize(nOffset + nBody);
+                    return partial.body.data() + nOffset;
+                }
+
+                m_msgTemporaryIn.body.resize(nBody);
+                return m_msgTemporaryIn.body.data();
+            }
+
+            // body of current frame is in place. returns false if reading has to stop for now
+            bool OnFrameRead()
+            {
+                uint32_t nSize = m_msgTemporaryIn.header.size;
+#ifndef _WIN32
+                if (nSize & frame::chunk)
+                    return OnChunkRead();
+#endif
+                if (nSize & frame::fragment)
+                {
+                    if (!(nSize & frame::last))
+                        return true;
+
+                    // message complete, hand over exactly as if it arrived whole
+                    auto &partial = m_msgPartialIn[(nSize & frame::lane_mask) >> frame::lane_shift];
+                    partial.header.id = m_msgTemporaryIn.header.id;
+                    partial.header.size = uint32_t(partial.body.size());
+                    m_msgTemporaryIn = std::move(partial);
+                    partial = {};
+                }
+
+                return AdmitMessage();
+            }
+
+#ifndef _WIN32
+            // check chunk in m_chunkIn against its stream, a stream's first chunk opens its file. pData is where
+            // the chunk's nData bytes go. false if remote broke the rules, connection is then closed
+            bool BeginChunk(const uint8_t *pName, size_t nData, uint8_t *&pData)
+            {
+                const char *sFail = nullptr;
+                auto it = m_mapStreamsIn.find(m_chunkIn.nStream);
+                if (m_sStreamDirectory.empty())
+                {
+                    sFail = "Unexpected Stream";
+                }
+                else if (nData > STREAM_CHUNK_LIMIT || m_chunkIn.nFlags != 0 || m_chunkIn.nTotal > m_nMaxStreamSize ||
+                         m_chunkIn.nOffset > m_chunkIn.nTotal || nData > m_chunkIn.nTotal - m_chunkIn.nOffset)
+                {
+                    sFail = "Bad Chunk";
+                }
+                else if (m_chunkIn.nOffset == 0)
+                {
+                    // first chunk names the file, a known stream has been restarted by remote
+                    std::string sName(reinterpret_cast<const char *>(pName), m_chunkIn.nNameLength);
+                    if (it == m_mapStreamsIn.end() && m_mapStreamsIn.size() >= STREAMS_IN_LIMIT)
+                        sFail = "Too Many Streams";
+                    else if (!IsSafeStreamName(sName))
+                        sFail = "Bad Stream Name";
+                    else
+                    {
+                        auto &pStream = m_mapStreamsIn[m_chunkIn.nStream];
+                        if (!pStream)
+                            pStream = std::make_unique<file_stream_in>();
+                        if (!pStream->Open(m_sStreamDirectory, sName, m_chunkIn.nTotal))
+                            sFail = "Stream Open Fail";
+                        it = m_mapStreamsIn.find(m_chunkIn.nStream);
+                    }
+                }
+                else if (it == m_mapStreamsIn.end() || m_chunkIn.nNameLength != 0 ||
+                         m_chunkIn.nOffset != it->second->Offset() || m_chunkIn.nTotal != it->second->Total())
+                {
+                    sFail = "Bad Chunk";
+                }
+
+                if (sFail)
+                {
+                    Log() << "[" << id << "] " << sFail << ".\n";
+                    m_socket.close();
+                    return false;
+                }
+
+                m_nChunkDataIn = nData;
+                pData = it->second->Data(m_chunkIn.nOffset);
+                return true;
+            }
+
+            // data of current chunk is in its file. a finished file is announced to the game as a message
+            // that carries its name & a stream_complete. it is not counted for session resume, as
+            // chunks are not replayed
+            bool OnChunkRead()
+            {
+                auto it = m_mapStreamsIn.find(m_chunkIn.nStream);
+                if (!it->second->Advance(m_nChunkDataIn))
+                    return true;
+
+                auto pStream = std::move(it->second);
+                m_mapStreamsIn.erase(it);
+                if (!pStream->Finish())
+                {
+                    Log() << "[" << id << "] Stream Finish Fail.\n";
+                    return true;
+                }
+
+                stream_complete complete;
+                complete.nBytes = pStream->Total();
+                complete.nStream = m_chunkIn.nStream;
+                m_msgTemporaryIn.body.assign(pStream->Name().begin(), pStream->Name().end());
+                m_msgTemporaryIn << complete;
+                AddToIncomingMessageQueue(false);
+                return true;
+            }
+#endif
+
+            // apply rate limits to complete message in m_msgTemporaryIn. returns false if reading has to stop
+            bool AdmitMessage()
+            {
+                if (!m_limiter.IsEnabled())
+                {
+                    AddToIncomingMessageQueue();
+                    return true;
+                }
+
+                auto wait = m_limiter.Admit(m_msgTemporaryIn.header.id, m_msgTemporaryIn.size(), std::chrono::steady_clock::now());
+                if (wait.count() == 0)
+                {
+                    AddToIncomingMessageQueue();
+                    return true;
+                }
+
+                switch (m_limiter.Action())
+                {
+                case limit_action::drop:
+                    m_nDropped++;
+                    return true;
+
+                case limit_action::disconnect:
+                    Log() << "[" << id << "] Rate Limit Exceeded.\n";
+                    m_socket.close();
+                    return false;
+
+                case limit_action::delay:
+                default:
+                    // hold message & stop reading, unread data backs up into client's TCP window
+                    m_bReadPaused = true;
+                    m_timerRead.expires_after(wait);
+                    m_timerRead.async_wait([this, self = this->shared_from_this()](std::error_code ec)
+                                           {
+                        if (ec || !m_bReadPaused || !m_socket.is_open())
+                            return;
+
+                        m_bReadPaused = false;
+                        m_tpLastRead = std::chrono::steady_clock::now();
+                        if (AdmitMessage())
+                            ProcessReadBuffer(); });
+                    return false;
+                }
+            }
+
+            // ASYNC - start next write unless one is in flight. while a file streams, writes alternate between
+            // a batch of lane frames & one chunk, so a stream never holds messages up for longer than a chunk
+            void WriteNext()
+            {
+                if (m_bWriting || !m_bEstablished || !m_socket.is_open())
+                    return;
+
+#ifndef _WIN32
+                if (!m_deqStreamsOut.empty() && (m_bChunkTurn || m_qMessagesOut.empty()))
+                {
+                    m_bChunkTurn = false;
+                    WriteChunk();
+                    return;
+                }
+                m_bChunkTurn = true;
+#endif
+                if (!m_qMessagesOut.empty())
+                    WriteFrame();
+            }
+
+            bool HasStreamsOut() const
+            {
+#ifndef _WIN32
+                return !m_deqStreamsOut.empty();
+#else
+                return false;
+#endif
+            }
+
+            // socket was replaced, remote has thrown away partly received files & partly sent ones start over
+            void RestartStreams()
+            {
+#ifndef _WIN32
+                m_mapStreamsIn.clear();
+                for (auto &stream : m_deqStreamsOut)
+                    stream.pFile->Restart();
+#endif
+            }
+
+#ifndef _WIN32
+            // ASYNC - write next chunk of the stream at front. frame header, chunk header & name come from memory,
+            // file data is then sendfile'd straight from page cache. userspace TLS has to encrypt the data
+            // itself, so there it is read into a buffer & written with the rest
+            void WriteChunk()
+            {
+                auto &stream = m_deqStreamsOut.front();
+                m_chunkOut = stream.pFile->NextChunk(m_nChunkSize);
+                size_t nName = m_chunkOut.nNameLength;
+                size_t nData = stream.pFile->ChunkData();
+
+                m_headerChunkOut.id = stream.nID;
+                m_headerChunkOut.size = frame::chunk | uint32_t(sizeof(chunk_header) + nName + nData);
+
+                m_vBuffersOut.clear();
+                m_vBuffersOut.push_back(asio::buffer(&m_headerChunkOut, sizeof(message_header<T>)));
+                m_vBuffersOut.push_back(asio::buffer(&m_chunkOut, sizeof(chunk_header)));
+                if (nName > 0)
+                    m_vBuffersOut.push_back(asio::buffer(stream.pFile->Name().data(), nName));
+
+                bool bSendFile = true;
+#ifdef NETP_USE_TLS
+                bSendFile = !m_pTls || m_bKernelTx;
+#endif
+                if (!bSendFile)
+                {
+                    m_vChunkOut.resize(nData);
+                    if (!stream.pFile->ReadChunk(m_vChunkOut.data()))
+                    {
+                        Log() << "[" << id << "] Stream Read Fail.\n";
+                        m_socket.close();
+                        return;
+                    }
+                    m_vBuffersOut.push_back(asio::buffer(m_vChunkOut.data(), nData));
+                }
+
+                m_bWriting = true;
+                AsyncWrite(m_vBuffersOut,
+                           [this, self = this->shared_from_this(), bSendFile](std::error_code ec, std::size_t length)
+                           {
+                               if (!ec)
+                               {
+                                   m_tpLastWrite = std::chrono::steady_clock::now();
+                                   if (bSendFile)
+                                       SendChunkData();
+                                   else
+                                       OnChunkWritten();
+                               }
+                               else
+                               {
+                                   m_bWriting = false;
+                                   Log() << "[" << id << "] Write Chunk Fail.\n";
+                                   OnSocketError(ec);
+                               }
+                           });
+            }
+
+            // ASYNC - sendfile rest of current chunk, waiting for socket to drain whenever it is full
+            void SendChunkData()
+            {
+                if (!m_socket.native_non_blocking())
+                {
+                    asio::error_code ecMode;
+                    m_socket.native_non_blocking(true, ecMode);
+                }
+
+                std::error_code ec;
+                if (m_deqStreamsOut.front().pFile->SendChunk(m_socket.native_handle(), ec))
+                {
+                    m_tpLastWrite = std::chrono::steady_clock::now();
+                    OnChunkWritten();
+                    return;
+                }
+
+                if (ec == std::errc::operation_would_block)
+                {
+                    m_socket.async_wait(asio::ip::tcp::socket::wait_write,
+                                        [this, self = this->shared_from_this()](std::error_code ec)
+                                        {
+                                            if (!ec)
+                                            {
+                                                SendChunkData();
+                                            }
+                                            else
+                                            {
+                                                m_bWriting = false;
+                                                Log() << "[" << id << "] Write Chunk Fail.\n";
+                                                OnSocketError(ec);
+                                            }
+                                        });
+                    return;
+                }
+
+                // frame is half written, the stream cannot carry on
+                m_bWriting = false;
+                Log() << "[" << id << "] Stream Send Fail.\n";
+                m_socket.close();
+            }
+
+            void OnChunkWritten()
+            {
+                m_bWriting = false;
+                auto &stream = m_deqStreamsOut.front();
+                stream.pFile->CompleteChunk();
+                if (stream.pFile->Done())
+                    m_deqStreamsOut.pop_front();
+                WriteNext();
+            }
+#endif
+
+            // ASYNC - write frames chosen by the lanes, up to a batch of them go out in one gathered write
+            void WriteFrame()
+            {
+                m_vBuffersOut.clear();
+
+                size_t nBytes = 0;
+                const uint8_t *pData = nullptr;
+                size_t nSize = 0;
+                while (m_vBuffersOut.size() < 2 * m_vHeadersOut.size() && nBytes < WRITE_BATCH_BYTES &&
+                       m_qMessagesOut.NextFrame(m_vHeadersOut[m_vBuffersOut.size() / 2], pData, nSize))
+                {
+                    m_vBuffersOut.push_back(asio::buffer(&m_vHeadersOut[m_vBuffersOut.size() / 2], sizeof(message_header<T>)));
+                    m_vBuffersOut.push_back(asio::buffer(pData, nSize));
+                    nBytes += sizeof(message_header<T>) + nSize;
+                }
+
+                m_bWriting = true;
+                AsyncWrite(m_vBuffersOut,
+                           [this, self = this->shared_from_this()](std::error_code ec, std::size_t length)
+                           {
+                               m_bWriting = false;
+                               if (!ec)
+                               {
+                                   m_tpLastWrite = std::chrono::steady_clock::now();
+                                   OnFramesWritten();
+                                   WriteNext();
+                               }
+                               else
+                               {
+                                   Log() << "[" << id << "] Write Frame Fail.\n";
+                                   OnSocketError(ec);
+                               }
+                           });
+            }
+
+            // keep a copy of every message just finished for replay if session can be resumed
+            void OnFramesWritten()
+            {
+                m_vWritten.clear();
+                m_qMessagesOut.CompleteFrames(m_vWritten);
+
+                if (m_pTracer)
+                {
+                    int64_t nNow = 0;
+                    for (auto &e : m_vWritten)
+                    {
+                        if (e.nTraced == 0)
+                            continue;
+                        if (nNow == 0)
+                            nNow = TraceNow();
+                        m_pTracer->Record(trace_stage::outbound, e.nTraced, nNow);
+                    }
+                }
+
+                if (m_nReplayLimit == 0)
+                    return;
+
+                for (auto &e : m_vWritten)
+                {
+                    m_deqReplay.push_back(std::move(e));
+                    m_nSequenceOut++;
+                }
+                while (m_deqReplay.size() > m_nReplayLimit)
+                    m_deqReplay.pop_front();
+            }
+
+            // I/O failed - resumable sessions are suspended rather than dropped
+            void OnSocketError(std::error_code ec)
+            {
+                // aborted operations belong to a socket that has already been closed or replaced
+                if (ec == asio::error::operation_aborted)
+                    return;
+
+                if (m_nOwnerType == owner::server && m_nReplayLimit > 0 && m_nSessionToken != 0 && m_bEstablished)
+                {
+                    m_tpSuspended = std::chrono::steady_clock::now();
+                    m_bSuspended = true;
+                    Log() << "[" << id << "] Session Suspended\n";
+                }
+
+                m_bEstablished = false;
+                m_bReadPaused = false;
+                m_timerRead.cancel();
+                m_socket.close();
             }
 
-            void AddToIncomingMessageQueue()
+            // bCounted is false for messages the connection makes up itself, they are not part of the session sequence
+            void AddToIncomingMessageQueue(bool bCounted = true)
             {
+                // read completion that brought last byte of message already took the time
+                trace_stamps trace;
+                if (m_pTracer && m_pTracer->SampleInbound())
+                {
+                    trace.nRead = TraceStamp(m_tpLastRead);
+                    trace.nEnqueue = TraceNow();
+                }
+
                 if (m_nOwnerType == owner::server)
-                    m_qMessagesIn.push_back({this->shared_from_this(), m_msgTemporaryIn});
+                {
+                    if (m_pCapture)
+                        m_pCapture->Write(id, m_msgTemporaryIn);
+                    m_qMessagesIn.push_back({this->shared_from_this(), m_msgTemporaryIn, trace});
+                }
                 else
-                    m_qMessagesIn.push_back({nullptr, m_msgTemporaryIn});
-
-                ReadHeader();
+                {
+                    // client counts whole messages received, this is what it asks to resume from
+                    if (bCounted)
+                        m_nSequenceIn++;
+                    // remote tells a swarm which of its clients this is for
+                    m_qMessagesIn.push_back({this->shared_from_this(), m_msgTemporaryIn, trace});
+                }
             }
 
             // encrypt data
@@ -230,85 +1207,225 @@ namespace netp
                 return out ^ 0xC0DEFACE12345678;
             }
 
-            // ASYNC
+            // ASYNC - server sends puzzle, client sends solution plus any session it wants to resume
             void WriteValidation()
             {
-                asio::async_write(m_socket, asio::buffer(&m_nHandshakeOut, sizeof(uint64_t)),
-                                  [this](std::error_code ec, std::size_t length)
+                if (m_nOwnerType == owner::client)
+                {
+                    m_sessionRequest.nValidation = m_nHandshakeOut;
+                    m_sessionRequest.nToken = m_nSessionToken;
+                    m_sessionRequest.nLastSequence = m_nSequenceIn;
+                }
+
+                auto buffer = m_nOwnerType == owner::server ? asio::buffer(&m_nHandshakeOut, sizeof(uint64_t))
+                                                            : asio::buffer(&m_sessionRequest, sizeof(session_request));
+
+                AsyncWrite(buffer,
+                           [this, self = this->shared_from_this()](std::error_code ec, std::size_t length)
+                           {
+                               if (!ec)
+                               {
+                                   // validation data sent, client wait for session details
+                                   if (m_nOwnerType == owner::client)
+                                       ReadSessionReply();
+                               }
+                               else
+                               {
+                                   OnSocketError(ec);
+                               }
+                           }
+
+                );
+            }
+
+            void ReadValidation(netp::net::server_interface<T> *server = nullptr)
+            {
+                auto buffer = m_nOwnerType == owner::server ? asio::buffer(&m_sessionRequest, sizeof(session_request))
+                                                            : asio::buffer(&m_nHandshakeIn, sizeof(uint64_t));
+
+                AsyncRead(buffer,
+                          [this, self = this->shared_from_this(), server](std::error_code ec, std::size_t length)
+                          {
+                              if (!ec)
+                              {
+                                  m_tpLastRead = std::chrono::steady_clock::now();
+
+                                  if (m_nOwnerType == owner::server)
                                   {
-                                      if (!ec)
+                                      if (m_sessionRequest.nValidation == m_nHandshakeCheck)
                                       {
-                                          // validation data sent, client wait for response
-                                          if (m_nOwnerType == owner::client)
-                                              ReadHeader();
+                                          // client provided valid solution, see if it is returning to a suspended session
+                                          if (m_sessionRequest.nToken != 0 &&
+                                              server->ResumeSession(m_sessionRequest.nToken, m_sessionRequest.nLastSequence, *this))
+                                          {
+                                              // socket now belongs to the old connection, this one is dropped silently
+                                              return;
+                                          }
+
+                                          // allow connection as a new session
+                                          Log() << "Client Validated" << std::endl;
+                                          m_nSessionToken = server->RegisterSession(this->shared_from_this());
+                                          server->OnClientValidated(this->shared_from_this());
+
+                                          WriteSessionReply(false);
                                       }
                                       else
                                       {
+                                          // Client gave incorrect data, disconnect
+                                          Log() << "Client Disconnected (Fail Validation)" << std::endl;
                                           m_socket.close();
                                       }
                                   }
+                                  else
+                                  {
+                                      // connection is a client, solve puzzle
+                                      m_nHandshakeOut = scramble(m_nHandshakeIn);
 
-                );
+                                      // write result
+                                      WriteValidation();
+                                  }
+                              }
+                              else
+                              {
+                                  // some big failure occured
+                                  Log() << "Client Disconnected (ReadValidation)" << std::endl;
+                                  OnSocketError(ec);
+                              }
+                          });
             }
 
-            void ReadValidation(netp::net::server_interface<T> *server = nullptr)
+            // ASYNC - server tells client its session token, then both sides start exchanging messages
+            void WriteSessionReply(bool bResumed)
             {
-                asio::async_read(m_socket, asio::buffer(&m_nHandshakeIn, sizeof(uint64_t)),
-                                 [this, server](std::error_code ec, std::size_t length)
-                                 {
-                                     if (!ec)
-                                     {
-                                         if (m_nOwnerType == owner::server)
-                                         {
-                                             if (m_nHandshakeIn == m_nHandshakeCheck)
-                                             {
-                                                 // client provided valid solution, allow connection
-                                                 std::cout << "Client Validated" << std::endl;
-                                                 server->OnClientValidated(this->shared_from_this());
-
-                                                 // sit and receive data
-                                                 ReadHeader();
-                                             }
-                                             else
-                                             {
-                                                 // Client gave incorrect data, disconnect
-                                                 std::cout << "Client Disconnected (Fail Validation)" << std::endl;
-                                                 m_socket.close();
-                                             }
-                                         }
-                                         else
-                                         {
-                                             // connection is a client, solve puzzle
-                                             m_nHandshakeOut = scramble(m_nHandshakeIn);
-
-                                             // write result
-                                             WriteValidation();
-                                         }
-                                     }
-                                     else
-                                     {
-                                         // some big failure occured
-                                         std::cout << "Client Disconnected (ReadValidation)" << std::endl;
-                                         m_socket.close();
-                                     }
-                                 });
+                m_sessionReply.nToken = m_nSessionToken;
+                m_sessionReply.nResumed = bResumed ? 1 : 0;
+
+                AsyncWrite(asio::buffer(&m_sessionReply, sizeof(session_reply)),
+                           [this, self = this->shared_from_this()](std::error_code ec, std::size_t length)
+                           {
+                               if (!ec)
+                               {
+                                   OnEstablished();
+                               }
+                               else
+                               {
+                                   OnSocketError(ec);
+                               }
+                           });
+            }
+
+            void ReadSessionReply()
+            {
+                AsyncRead(asio::buffer(&m_sessionReply, sizeof(session_reply)),
+                          [this, self = this->shared_from_this()](std::error_code ec, std::size_t length)
+                          {
+                              if (!ec)
+                              {
+                                  m_tpLastRead = std::chrono::steady_clock::now();
+
+                                  // a fresh session means server has forgotten us, count messages from scratch
+                                  m_bResumed = m_sessionReply.nResumed != 0;
+                                  if (!m_bResumed)
+                                      m_nSequenceIn = 0;
+                                  m_nSessionToken = m_sessionReply.nToken;
+
+                                  OnEstablished();
+                              }
+                              else
+                              {
+                                  Log() << "Client Disconnected (ReadSessionReply)" << std::endl;
+                                  OnSocketError(ec);
+                              }
+                          });
+            }
+
+            // handshake complete - sit and receive data, flush anything queued in the meantime
+            void OnEstablished()
+            {
+                m_bEstablished = true;
+                m_bReadPaused = false;
+                m_nReadStart = m_nReadEnd = 0;
+                ReadSome();
+                WriteNext();
             }
 
         protected:
             // each connection will have a unique socket to remote
             asio::ip::tcp::socket m_socket;
 
+#ifdef NETP_USE_TLS
+            // TLS session over m_socket, nullptr for a plain connection
+            std::shared_ptr<tls_context> m_pTlsContext;
+            std::unique_ptr<tls_stream> m_pTls;
+            tls_secrets m_tlsSecrets;
+            bool m_bKernelTx = false;
+#endif
+
             // this contet is shared with entire asio instance
             asio::io_context &m_asioContext;
 
-            // queue holding all messages to be sent to remote site
-            tsqueue<message<T>> m_qMessagesOut;
+            // lanes holding all messages to be sent to remote site, only touched on asio thread
+            lane_queue<T> m_qMessagesOut;
+
+            // frames of the write in progress, reused for every write
+            static constexpr size_t WRITE_BATCH_BYTES = 64 * 1024;
+            std::array<message_header<T>, 64> m_vHeadersOut;
+            std::vector<asio::const_buffer> m_vBuffersOut;
+            std::vector<typename lane_queue<T>::entry> m_vWritten;
+            bool m_bWriting = false;
+
+#ifndef _WIN32
+            // file streams - outgoing ones are sent front first, a chunk at a time
+            struct stream_out
+            {
+                T nID{};
+                std::shared_ptr<file_stream_out> pFile;
+            };
+            std::deque<stream_out> m_deqStreamsOut;
+            std::atomic<uint32_t> m_nStreamCounter = 0;
+            size_t m_nChunkSize = 64 * 1024;
+            bool m_bChunkTurn = false;
+            message_header<T> m_headerChunkOut;
+            chunk_header m_chunkOut;
+            std::vector<uint8_t> m_vChunkOut; // chunk data, only when sendfile cannot be used
+
+            // incoming streams by stream number, & the chunk currently being read
+            std::unordered_map<uint32_t, std::unique_ptr<file_stream_in>> m_mapStreamsIn;
+            std::string m_sStreamDirectory;
+            uint64_t m_nMaxStreamSize = 0;
+            chunk_header m_chunkIn;
+            size_t m_nChunkDataIn = 0;
+#endif
 
             // queue holding all messages sent in from remote site,
             // note it is a reference as "owner" of this connection is expected to provide a queue
             tsqueue<owned_message<T>> &m_qMessagesIn;
             message<T> m_msgTemporaryIn;
 
+            // large messages being reassembled from fragments, one per lane
+            std::array<message<T>, PRIORITY_LANES> m_msgPartialIn;
+
+            // receive buffer allocated once per connection, every read lands here and may hold
+            // several frames. bytes [m_nReadStart, m_nReadEnd) are received but not yet parsed
+            std::vector<uint8_t> m_vReadBuffer = std::vector<uint8_t>(64 * 1024);
+            size_t m_nReadStart = 0;
+            size_t m_nReadEnd = 0;
+
+            // flood protection
+            uint32_t m_nMaxMessageSize = 16 * 1024 * 1024;
+            rate_limiter<T> m_limiter;
+            asio::steady_timer m_timerRead;
+            bool m_bReadPaused = false;
+            uint64_t m_nDropped = 0;
+
+            // draining / handoff - input is no longer parsed. a large frame's body is being read straight from
+            // socket, set until all of it has arrived even if the read is cancelled
+            bool m_bReadStopped = false;
+            bool m_bReadingBody = false;
+
+            // nodelay, buffer sizes etc. given by owner
+            socket_options m_socketOptions;
+
             // "owner" decides how connection behaves
             owner m_nOwnerType = owner::server;
             uint32_t id = 0;
@@ -317,6 +1434,34 @@ namespace netp
             uint64_t m_nHandshakeOut = 0;
             uint64_t m_nHandshakeIn = 0;
             uint64_t m_nHandshakeCheck = 0;
+
+            // activity timestamps, only touched from the asio thread
+            std::chrono::steady_clock::time_point m_tpLastRead;
+            std::chrono::steady_clock::time_point m_tpLastWrite;
+
+            // set once owner has removed connection & notified application
+            std::atomic<bool> m_bRemoved = false;
+
+            // session resumption, sequence numbers count whole messages in each direction
+            session_request m_sessionRequest;
+            session_reply m_sessionReply;
+            uint64_t m_nSessionToken = 0;
+            uint64_t m_nSequenceIn = 0;
+            uint64_t m_nSequenceOut = 0;
+            bool m_bEstablished = false;
+            bool m_bResumed = false;
+
+            // server only - copies of recently sent messages, kept while session is resumable
+            std::deque<typename lane_queue<T>::entry> m_deqReplay;
+            size_t m_nReplayLimit = 0;
+            std::atomic<bool> m_bSuspended = false;
+            std::chrono::steady_clock::time_point m_tpSuspended;
+
+            // server only - traffic capture shared by all connections, owned by server
+            capture_writer *m_pCapture = nullptr;
+
+            // optional latency tracing, owned by server / client
+            message_tracer *m_pTracer = nullptr;
         };
 
     }
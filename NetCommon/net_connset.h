@@ -0,0 +1,197 @@
+#pragma once
+#include "net_common.h"
+#include "net_connection.h"
+
+namespace netp
+{
+    namespace net
+    {
+        // set of a server's connections that any thread can iterate while it changes. readers pin the current
+        // version & walk it without locks or allocation. writers copy it, apply a whole batch of additions &
+        // removals to the copy and publish that in one atomic store. a replaced version is freed by a later
+        // writer once every reader that could have loaded it has finished. readers are counted in one of two
+        // slots & writers steer new readers to the other one, so the slot an old version waits on drains even
+        // while reads never stop. readers must not hold a view for long. a version only holds references, where it
+        // drops the last one does not matter - a connection's queued handlers & messages keep it alive themselves
+        template <typename T>
+        class connection_set
+        {
+        public:
+            // one immutable version of the set
+            struct version
+            {
+                std::vector<std::shared_ptr<connection<T>>> vConnections;
+                std::unordered_map<uint32_t, size_t> mapIndex; // connection ID -> index into vConnections
+            };
+
+            // keeps the version current at construction alive until destroyed
+            class view
+            {
+            public:
+                explicit view(const connection_set &set)
+                    : m_set(set)
+                {
+                    // announce reader before loading, so a writer that has already swapped the
+                    // version out cannot free what is loaded below
+                    m_nSlot = m_set.m_nReaderSlot.load(std::memory_order_seq_cst);
+                    m_set.m_nReaders[m_nSlot].fetch_add(1, std::memory_order_seq_cst);
+                    m_pVersion = m_set.m_pCurrent.load(std::memory_order_seq_cst);
+                }
+
+                view(const view &) = delete;
+                view &operator=(const view &) = delete;
+
+                ~view()
+                {
+                    m_set.m_nReaders[m_nSlot].fetch_sub(1, std::memory_order_release);
+                }
+
+                auto begin() const { return m_pVersion->vConnections.begin(); }
+                auto end() const { return m_pVersion->vConnections.end(); }
+                size_t size() const { return m_pVersion->vConnections.size(); }
+                bool empty() const { return m_pVersion->vConnections.empty(); }
+
+                // connection with nID, nullptr if not in this version
+                std::shared_ptr<connection<T>> Find(uint32_t nID) const
+                {
+                    auto it = m_pVersion->mapIndex.find(nID);
+                    return it == m_pVersion->mapIndex.end() ? nullptr : m_pVersion->vConnections[it->second];
+                }
+
+            private:
+                const connection_set &m_set;
+                const version *m_pVersion = nullptr;
+                uint32_t m_nSlot = 0;
+            };
+
+        public:
+            connection_set()
+            {
+                m_pCurrent.store(new version());
+            }
+
+            connection_set(const connection_set &) = delete;
+
+            ~connection_set()
+            {
+                delete m_pCurrent.load();
+                for (auto &retired : m_vRetired)
+                    delete retired.pVersion;
+            }
+
+            // lock free read access to current version
+            view Read() const
+            {
+                return view(*this);
+            }
+
+            size_t size() const
+            {
+                return Read().size();
+            }
+
+            // copy of current connections, for work that outlives a view
+            std::vector<std::shared_ptr<connection<T>>> Copy() const
+            {
+                view v = Read();
+                return std::vector<std::shared_ptr<connection<T>>>(v.begin(), v.end());
+            }
+
+            // publish a new version with vAdd appended & every connection for which remove(client) is true dropped
+            template <typename Pred>
+            void Update(const std::vector<std::shared_ptr<connection<T>>> &vAdd, Pred remove)
+            {
+                std::scoped_lock lock(m_muxWrite);
+                const version *pOld = m_pCurrent.load(std::memory_order_relaxed);
+
+                auto pNew = new version();
+                pNew->vConnections.reserve(pOld->vConnections.size() + vAdd.size());
+                for (auto &client : pOld->vConnections)
+                    if (!remove(client))
+                        pNew->vConnections.push_back(client);
+                for (auto &client : vAdd)
+                    if (client && !remove(client))
+                        pNew->vConnections.push_back(client);
+
+                pNew->mapIndex.reserve(pNew->vConnections.size());
+                for (size_t i = 0; i < pNew->vConnections.size(); i++)
+                    pNew->mapIndex[pNew->vConnections[i]->GetID()] = i;
+
+                m_pCurrent.store(pNew, std::memory_order_seq_cst);
+                m_vRetired.push_back({pOld, 0});
+                ReclaimRetired();
+            }
+
+            void Add(const std::vector<std::shared_ptr<connection<T>>> &vAdd)
+            {
+                Update(vAdd, [](const std::shared_ptr<connection<T>> &)
+                       { return false; });
+            }
+
+            template <typename Pred>
+            void RemoveIf(Pred remove)
+            {
+                Update({}, remove);
+            }
+
+            void Clear()
+            {
+                RemoveIf([](const std::shared_ptr<connection<T>> &)
+                         { return true; });
+            }
+
+            // free replaced versions if no reader can still see them, writers do this as they go
+            void Reclaim()
+            {
+                std::scoped_lock lock(m_muxWrite);
+                ReclaimRetired();
+            }
+
+        private:
+            void ReclaimRetired()
+            {
+                if (m_vRetired.empty())
+                    return;
+
+                // a reader that loaded a retired version registered in a slot before doing so, & every version
+                // here was replaced before this check. once a slot is seen empty, nobody counted in it holds one
+                // of them, & anyone who registers there later loads a newer version
+                for (uint32_t nSlot = 0; nSlot < 2; nSlot++)
+                    if (m_nReaders[nSlot].load(std::memory_order_seq_cst) == 0)
+                        for (auto &retired : m_vRetired)
+                            retired.nDrained |= 1u << nSlot;
+
+                // free versions both slots have drained since, oldest first
+                auto it = m_vRetired.begin();
+                while (it != m_vRetired.end() && it->nDrained == 3)
+                    delete (it++)->pVersion;
+                m_vRetired.erase(m_vRetired.begin(), it);
+
+                // oldest survivor still waits on a slot, send new readers to the other one so it drains
+                if (!m_vRetired.empty())
+                {
+                    uint32_t nWaiting = (m_vRetired.front().nDrained & 1) ? 1 : 0;
+                    m_nReaderSlot.store(1 - nWaiting, std::memory_order_seq_cst);
+                }
+            }
+
+        private:
+            std::atomic<const version *> m_pCurrent{nullptr};
+
+            // readers active in each slot, & slot new readers count themselves in
+            mutable std::atomic<uint32_t> m_nReaders[2] = {0, 0};
+            std::atomic<uint32_t> m_nReaderSlot{0};
+
+            // replaced version, & bit per slot seen empty since it was replaced
+            struct retired_version
+            {
+                const version *pVersion;
+                uint32_t nDrained;
+            };
+
+            // writers only, oldest first
+            std::mutex m_muxWrite;
+            std::vector<retired_version> m_vRetired;
+        };
+    }
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include "net_common.h"
+
+namespace netp
+{
+    namespace net
+    {
+        // hands out storage aligned for SIMD loads, 64 bytes covers AVX registers & a cache line
+        template <typename T, size_t Alignment = 64>
+        struct aligned_allocator
+        {
+            using value_type = T;
+
+            template <typename U>
+            struct rebind
+            {
+                using other = aligned_allocator<U, Alignment>;
+            };
+
+            aligned_allocator() = default;
+
+            template <typename U>
+            aligned_allocator(const aligned_allocator<U, Alignment> &) {}
+
+            T *allocate(size_t n)
+            {
+                return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+            }
+
+            void deallocate(T *p, size_t n)
+            {
+                ::operator delete(p, std::align_val_t(Alignment));
+            }
+
+            template <typename U>
+            bool operator==(const aligned_allocator<U, Alignment> &) const { return true; }
+
+            template <typename U>
+            bool operator!=(const aligned_allocator<U, Alignment> &) const { return false; }
+        };
+
+        template <typename T>
+        using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
+        // per player game state as dense structure-of-arrays keyed by connection ID. entity i lives at
+        // index i of every component array, so a per-tick pass over eg. positions touches contiguous,
+        // aligned memory. removing an entity moves the last one into its slot, so indices are not stable
+        // across Remove() - look them up again with IndexOf(). game thread only
+        class entity_store
+        {
+        public:
+            static constexpr size_t npos = size_t(-1);
+
+        public:
+            // number of entities
+            size_t size() const
+            {
+                return ids.size();
+            }
+
+            bool empty() const
+            {
+                return ids.empty();
+            }
+
+            void reserve(size_t n)
+            {
+                ForEachArray([n](auto &v)
+                             { v.reserve(n); });
+                m_mapIndex.reserve(n);
+            }
+
+            void clear()
+            {
+                ForEachArray([](auto &v)
+                             { v.clear(); });
+                m_mapIndex.clear();
+            }
+
+            bool Contains(uint32_t nID) const
+            {
+                return m_mapIndex.count(nID) != 0;
+            }
+
+            // index of entity's components, npos if not present
+            size_t IndexOf(uint32_t nID) const
+            {
+                auto it = m_mapIndex.find(nID);
+                return it == m_mapIndex.end() ? npos : it->second;
+            }
+
+            // adds entity with zeroed components (full health), returns its index. existing entity is left as is
+            size_t Add(uint32_t nID)
+            {
+                auto it = m_mapIndex.find(nID);
+                if (it != m_mapIndex.end())
+                    return it->second;
+
+                size_t i = ids.size();
+                ids.push_back(nID);
+                posX.push_back(0.0f);
+                posY.push_back(0.0f);
+                posZ.push_back(0.0f);
+                velX.push_back(0.0f);
+                velY.push_back(0.0f);
+                velZ.push_back(0.0f);
+                health.push_back(100.0f);
+
+                m_mapIndex[nID] = i;
+                return i;
+            }
+
+            // removes entity, last entity takes its place so arrays stay packed. returns false if not present
+            bool Remove(uint32_t nID)
+            {
+                auto it = m_mapIndex.find(nID);
+                if (it == m_mapIndex.end())
+                    return false;
+
+                size_t i = it->second;
+                size_t nLast = ids.size() - 1;
+                if (i != nLast)
+                {
+                    ForEachArray([i, nLast](auto &v)
+                                 { v[i] = v[nLast]; });
+                    m_mapIndex[ids[i]] = i;
+                }
+
+                ForEachArray([](auto &v)
+                             { v.pop_back(); });
+                m_mapIndex.erase(it);
+                return true;
+            }
+
+        public:
+            // component arrays, all of length size(). elements may be modified freely,
+            // but only Add()/Remove() may change their length
+            aligned_vector<uint32_t> ids;
+            aligned_vector<float> posX, posY, posZ;
+            aligned_vector<float> velX, velY, velZ;
+            aligned_vector<float> health;
+
+        private:
+            template <typename Func>
+            void ForEachArray(Func func)
+            {
+                func(ids);
+                func(posX);
+                func(posY);
+                func(posZ);
+                func(velX);
+                func(velY);
+                func(velZ);
+                func(health);
+            }
+
+            // connection ID -> index into component arrays
+            std::unordered_map<uint32_t, size_t> m_mapIndex;
+        };
+    }
+}
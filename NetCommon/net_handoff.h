@@ -0,0 +1,133 @@
+#pragma once
+#include "net_common.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace netp
+{
+    namespace net
+    {
+        // hot restart: a running server passes its listening socket and live client sockets to a
+        // new process over a unix domain socket, clients never notice the restart
+
+        // first packet of a handoff, carries listening socket
+        struct handoff_header
+        {
+            char sMagic[8] = {'N', 'E', 'T', 'P', 'H', 'O', 'F', '1'};
+            uint32_t nConnections = 0;
+            uint32_t nNextID = 0;
+        };
+
+        // one packet per client socket, followed by bytes received but not yet parsed
+        struct handoff_record
+        {
+            uint32_t nID = 0;
+            uint32_t nLeftover = 0;
+            uint64_t nSessionToken = 0;
+            uint64_t nSequenceOut = 0;
+        };
+
+#ifndef _WIN32
+        namespace handoff
+        {
+            // largest packet, a record plus a full receive buffer of leftover bytes
+            constexpr size_t MAX_PACKET = sizeof(handoff_record) + 64 * 1024;
+
+            // SOCK_SEQPACKET keeps each record & its descriptor together
+            inline int Listen(const std::string &sPath)
+            {
+                sockaddr_un addr{};
+                if (sPath.size() >= sizeof(addr.sun_path))
+                    return -1;
+                addr.sun_family = AF_UNIX;
+                std::strncpy(addr.sun_path, sPath.c_str(), sizeof(addr.sun_path) - 1);
+
+                int nSocket = ::socket(AF_UNIX, SOCK_SEQPACKET, 0);
+                if (nSocket < 0)
+                    return -1;
+
+                ::unlink(sPath.c_str());
+                if (::bind(nSocket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(nSocket, 1) < 0)
+                {
+                    ::close(nSocket);
+                    return -1;
+                }
+                return nSocket;
+            }
+
+            inline int Connect(const std::string &sPath)
+            {
+                sockaddr_un addr{};
+                if (sPath.size() >= sizeof(addr.sun_path))
+                    return -1;
+                addr.sun_family = AF_UNIX;
+                std::strncpy(addr.sun_path, sPath.c_str(), sizeof(addr.sun_path) - 1);
+
+                int nSocket = ::socket(AF_UNIX, SOCK_SEQPACKET, 0);
+                if (nSocket < 0)
+                    return -1;
+
+                if (::connect(nSocket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+                {
+                    ::close(nSocket);
+                    return -1;
+                }
+                return nSocket;
+            }
+
+            // sends one packet, with descriptor fd attached unless it is -1
+            inline bool Send(int nSocket, const void *pData, size_t nSize, int fd)
+            {
+                iovec iov{const_cast<void *>(pData), nSize};
+                msghdr msg{};
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+
+                alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+                if (fd >= 0)
+                {
+                    msg.msg_control = control;
+                    msg.msg_controllen = sizeof(control);
+                    cmsghdr *pCmsg = CMSG_FIRSTHDR(&msg);
+                    pCmsg->cmsg_level = SOL_SOCKET;
+                    pCmsg->cmsg_type = SCM_RIGHTS;
+                    pCmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                    std::memcpy(CMSG_DATA(pCmsg), &fd, sizeof(int));
+                }
+
+                return ::sendmsg(nSocket, &msg, MSG_NOSIGNAL) == ssize_t(nSize);
+            }
+
+            // receives one packet into vData, fd is the attached descriptor or -1. returns false on error / hang up
+            inline bool Receive(int nSocket, std::vector<uint8_t> &vData, int &fd)
+            {
+                vData.resize(MAX_PACKET);
+                iovec iov{vData.data(), vData.size()};
+                msghdr msg{};
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+
+                alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+
+                ssize_t n = ::recvmsg(nSocket, &msg, MSG_CMSG_CLOEXEC);
+                if (n <= 0)
+                    return false;
+                vData.resize(size_t(n));
+
+                fd = -1;
+                for (cmsghdr *pCmsg = CMSG_FIRSTHDR(&msg); pCmsg; pCmsg = CMSG_NXTHDR(&msg, pCmsg))
+                {
+                    if (pCmsg->cmsg_level == SOL_SOCKET && pCmsg->cmsg_type == SCM_RIGHTS)
+                        std::memcpy(&fd, CMSG_DATA(pCmsg), sizeof(int));
+                }
+                return true;
+            }
+        }
+#endif
+    }
+}
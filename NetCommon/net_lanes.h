@@ -0,0 +1,194 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+
+namespace netp
+{
+    namespace net
+    {
+        // outgoing messages are sent through lanes, a bulk transfer cannot hold up a latency-critical update
+        enum class priority : uint8_t
+        {
+            high,
+            normal,
+            bulk
+        };
+
+        constexpr size_t PRIORITY_LANES = 3;
+
+        // per connection queue of outgoing messages split into priority lanes. each lane is FIFO,
+        // lanes are interleaved a frame at a time by smooth weighted round robin. several frames may be
+        // handed out before any complete, so they can go in one write. not thread safe, connection only
+        // touches it from the asio thread
+        template <typename T>
+        class lane_queue
+        {
+        public:
+            struct entry
+            {
+                message<T> msg;
+                priority nPriority = priority::normal;
+                size_t nOffset = 0;    // bytes of body already sent
+                size_t nScheduled = 0; // bytes of body handed out in frames
+                int64_t nTraced = 0;   // TraceNow() when Send() was called, 0 if not traced
+            };
+
+        public:
+            lane_queue()
+            {
+                SetWeight(priority::high, 8);
+                SetWeight(priority::normal, 4);
+                SetWeight(priority::bulk, 1);
+            }
+
+            // frames a lane gets relative to the others while they all have data
+            void SetWeight(priority nPriority, int32_t nWeight)
+            {
+                m_lanes[size_t(nPriority)].nWeight = std::max<int32_t>(nWeight, 1);
+            }
+
+            // bodies larger than this are sent as fragments
+            void SetFragmentSize(size_t nBytes)
+            {
+                m_nFragmentSize = std::clamp<size_t>(nBytes, 1, frame::size_mask);
+            }
+
+            bool empty() const
+            {
+                return m_nCount == 0;
+            }
+
+            size_t count() const
+            {
+                return m_nCount;
+            }
+
+            void push_back(const message<T> &msg, priority nPriority, int64_t nTraced = 0)
+            {
+                m_lanes[size_t(nPriority)].deqEntries.push_back({msg, nPriority, 0, 0, nTraced});
+                m_nCount++;
+            }
+
+            // only valid while no frames are in flight
+            void push_front(entry e)
+            {
+                e.nOffset = 0;
+                e.nScheduled = 0;
+                e.nTraced = 0; // latency of a resent message was counted when first written
+                auto nLane = size_t(e.nPriority);
+                m_lanes[nLane].deqEntries.push_front(std::move(e));
+                m_nCount++;
+            }
+
+            // forget frames in flight & partially sent messages, everything starts over.
+            // eg. when remote has lost the fragments it had
+            void Restart()
+            {
+                for (auto &lane : m_lanes)
+                {
+                    lane.nPending = 0;
+                    for (auto &e : lane.deqEntries)
+                        e.nOffset = e.nScheduled = 0;
+                }
+                m_vInFlight.clear();
+            }
+
+            // choose lane & describe the next frame to send, returns false if everything is already in flight.
+            // pData stays valid until the frame is completed
+            bool NextFrame(message_header<T> &header, const uint8_t *&pData, size_t &nSize)
+            {
+                // smooth weighted round robin over lanes that have data
+                int32_t nTotal = 0;
+                size_t nBest = PRIORITY_LANES;
+                for (size_t i = 0; i < PRIORITY_LANES; i++)
+                {
+                    auto &lane = m_lanes[i];
+                    if (lane.nPending >= lane.deqEntries.size())
+                        continue;
+
+                    lane.nCurrent += lane.nWeight;
+                    nTotal += lane.nWeight;
+                    if (nBest == PRIORITY_LANES || lane.nCurrent > m_lanes[nBest].nCurrent)
+                        nBest = i;
+                }
+                if (nBest == PRIORITY_LANES)
+                    return false;
+
+                auto &lane = m_lanes[nBest];
+                lane.nCurrent -= nTotal;
+
+                auto &e = lane.deqEntries[lane.nPending];
+                size_t nBody = e.msg.body.size();
+                header.id = e.msg.header.id;
+                pData = e.msg.body.data() + e.nScheduled;
+
+                if (e.nScheduled == 0 && nBody <= m_nFragmentSize)
+                {
+                    // small enough to go whole
+                    header.size = uint32_t(nBody);
+                    nSize = nBody;
+                }
+                else
+                {
+                    nSize = std::min(m_nFragmentSize, nBody - e.nScheduled);
+                    header.size = frame::fragment | (uint32_t(nBest) << frame::lane_shift) | uint32_t(nSize);
+                    if (e.nScheduled + nSize == nBody)
+                        header.size |= frame::last;
+                }
+
+                e.nScheduled += nSize;
+                if (e.nScheduled == nBody)
+                    lane.nPending++;
+
+                m_vInFlight.push_back({nBest, nSize});
+                return true;
+            }
+
+            // every frame handed out so far has been written. messages they finished are moved to vDone in send order
+            void CompleteFrames(std::vector<entry> &vDone)
+            {
+                // a lane's frames are handed out front to back, so they complete its front entry
+                for (auto &f : m_vInFlight)
+                {
+                    auto &lane = m_lanes[f.nLane];
+                    auto &e = lane.deqEntries.front();
+                    e.nOffset += f.nSize;
+                    if (e.nOffset < e.msg.body.size())
+                        continue;
+
+                    vDone.push_back(std::move(e));
+                    lane.deqEntries.pop_front();
+                    lane.nPending--;
+                    m_nCount--;
+
+                    // lane drained, its credit should not carry over to its next burst
+                    if (lane.deqEntries.empty())
+                        lane.nCurrent = 0;
+                }
+                m_vInFlight.clear();
+            }
+
+        private:
+            struct lane
+            {
+                std::deque<entry> deqEntries;
+                size_t nPending = 0; // entries at front fully handed out, waiting to complete
+                int32_t nWeight = 1;
+                int32_t nCurrent = 0;
+            };
+
+            struct frame_in_flight
+            {
+                size_t nLane = 0;
+                size_t nSize = 0;
+            };
+
+            std::array<lane, PRIORITY_LANES> m_lanes;
+            size_t m_nCount = 0;
+            size_t m_nFragmentSize = 16 * 1024;
+
+            // frames handed out but not yet written, in order
+            std::vector<frame_in_flight> m_vInFlight;
+        };
+    }
+}
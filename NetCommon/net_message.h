@@ -1,5 +1,6 @@
 #pragma once
 #include "net_common.h"
+#include "net_trace.h"
 
 namespace netp
 {
@@ -13,6 +14,19 @@ namespace netp
             uint32_t size = 0;
         };
 
+        // on the wire a frame reuses message_header, top bits of size carry framing flags.
+        // large messages are split into fragments so other lanes can interleave between them,
+        // files are streamed as chunks that carry a chunk_header (net_stream.h) & never become a message
+        namespace frame
+        {
+            constexpr uint32_t fragment = 0x80000000;  // frame is part of a larger message
+            constexpr uint32_t last = 0x40000000;      // final fragment, message is complete
+            constexpr uint32_t chunk = 0x20000000;     // frame is a piece of a file stream, no other flags
+            constexpr uint32_t lane_mask = 0x18000000; // lane the fragmented message travels in
+            constexpr uint32_t lane_shift = 27;
+            constexpr uint32_t size_mask = 0x07FFFFFF; // bytes of body in this frame
+        }
+
         template <typename T>
         struct message
         {
@@ -87,6 +101,7 @@ namespace netp
         {
             std::shared_ptr<connection<T>> remote = nullptr;
             message<T> msg;
+            trace_stamps trace; // all zero unless message was sampled for tracing
 
             // friendly string maker
             friend std::ostream &operator<<(std::ostream &os, const owned_message<T> &msg)
@@ -0,0 +1,526 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace netp
+{
+    namespace net
+    {
+#ifndef _WIN32
+        // state log starts with this, followed by one record per write
+        struct state_log_header
+        {
+            char sMagic[8] = {'N', 'E', 'T', 'P', 'L', 'O', 'G', '1'};
+        };
+
+        // precedes nSize bytes of state. a record whose checksum does not match marks a torn tail
+        struct state_log_record
+        {
+            uint64_t nKey = 0;
+            uint32_t nSize = 0;
+            uint32_t nFlags = 0; // FLAG_ERASE: key was removed, no data follows
+            uint32_t nChecksum = 0;
+            uint32_t nReserved = 0;
+        };
+
+        // write-behind persistence for per player state, keyed by player or connection ID. Put() only updates
+        // memory & marks key dirty, so game thread never touches disk. a background thread writes dirty keys in
+        // batches to an append-only log - a key changed many times between flushes is written once - and rewrites
+        // log with only live state when it has grown to several times that. when the log is opened it is mapped
+        // & replayed, a torn record left by a crash is cut off. only one process may have the log open at a time
+        class state_store
+        {
+        public:
+            // bOpen = false leaves log alone until Open(), eg. while another process still writes it
+            state_store(const std::string &sPath, std::chrono::milliseconds flushInterval = std::chrono::seconds(1), bool bOpen = true)
+                : m_sPath(sPath), m_flushInterval(flushInterval)
+            {
+                if (bOpen)
+                    Open();
+            }
+
+            state_store(const state_store &) = delete;
+
+            virtual ~state_store()
+            {
+                Close();
+            }
+
+        public:
+            // replay log into memory & start writing to it. changes Put() before this are newer than the log & kept
+            void Open()
+            {
+                std::unique_lock<std::mutex> lockFile(m_muxFile);
+                std::unique_lock<std::mutex> lock(m_muxState);
+                if (m_bOpen)
+                    return;
+
+                Recover();
+                m_bOpen = true;
+                m_bStop = false;
+                m_threadFlush = std::thread([this]()
+                                            { FlushLoop(); });
+            }
+
+            // write everything dirty, stop flushing & close log so another process can open it, eg. before a
+            // handoff. Put() still updates memory afterwards, but nothing reaches disk unless log is opened again
+            void Close()
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_muxState);
+                    if (!m_bOpen)
+                        return;
+                    m_bStop = true;
+                }
+                m_cvFlush.notify_all();
+                if (m_threadFlush.joinable())
+                    m_threadFlush.join();
+
+                std::unique_lock<std::mutex> lockFile(m_muxFile);
+                std::unique_lock<std::mutex> lock(m_muxState);
+                if (m_pFile)
+                    std::fclose(m_pFile);
+                m_pFile = nullptr;
+                m_bOpen = false;
+            }
+
+            // store latest state of nKey, written to disk on a later flush. safe from any thread
+            void Put(uint64_t nKey, const void *pData, size_t nSize)
+            {
+                auto pState = std::make_shared<const std::vector<uint8_t>>(
+                    static_cast<const uint8_t *>(pData), static_cast<const uint8_t *>(pData) + nSize);
+
+                bool bWake = false;
+                {
+                    std::unique_lock<std::mutex> lock(m_muxState);
+                    auto &pOld = m_mapState[nKey];
+                    m_nLiveBytes += RecordSize(nSize) - (pOld ? RecordSize(pOld->size()) : 0);
+                    pOld = pState;
+                    m_mapDirty[nKey] = std::move(pState);
+                    bWake = m_mapDirty.size() >= FLUSH_BATCH;
+                }
+                if (bWake)
+                    m_cvFlush.notify_one();
+            }
+
+            void Put(uint64_t nKey, const std::vector<uint8_t> &vData)
+            {
+                Put(nKey, vData.data(), vData.size());
+            }
+
+            // store body of msg, eg. a message the application already serialises its player into
+            template <typename T>
+            void Put(uint64_t nKey, const message<T> &msg)
+            {
+                Put(nKey, msg.body.data(), msg.body.size());
+            }
+
+            void Erase(uint64_t nKey)
+            {
+                std::unique_lock<std::mutex> lock(m_muxState);
+                auto it = m_mapState.find(nKey);
+                if (it == m_mapState.end())
+                    return;
+
+                m_nLiveBytes -= RecordSize(it->second->size());
+                m_mapState.erase(it);
+                m_mapDirty[nKey] = nullptr;
+            }
+
+            // latest state of nKey, whether flushed yet or not. false if there is none
+            bool Get(uint64_t nKey, std::vector<uint8_t> &vData) const
+            {
+                std::unique_lock<std::mutex> lock(m_muxState);
+                auto it = m_mapState.find(nKey);
+                if (it == m_mapState.end())
+                    return false;
+
+                vData = *it->second;
+                return true;
+            }
+
+            template <typename T>
+            bool Get(uint64_t nKey, message<T> &msg) const
+            {
+                if (!Get(nKey, msg.body))
+                    return false;
+                msg.header.size = uint32_t(msg.size());
+                return true;
+            }
+
+            bool Contains(uint64_t nKey) const
+            {
+                std::unique_lock<std::mutex> lock(m_muxState);
+                return m_mapState.count(nKey) != 0;
+            }
+
+            // number of keys stored
+            size_t size() const
+            {
+                std::unique_lock<std::mutex> lock(m_muxState);
+                return m_mapState.size();
+            }
+
+            // write everything dirty & wait until it is on disk, eg. before shutting down. nothing to do while closed
+            void Flush()
+            {
+                std::unique_lock<std::mutex> lock(m_muxState);
+                if (!m_bOpen)
+                    return;
+                uint64_t nWanted = ++m_nFlushRequested;
+                m_cvFlush.notify_all();
+                m_cvFlushed.wait(lock, [this, nWanted]()
+                                 { return m_nFlushed >= nWanted || m_bStop; });
+            }
+
+            // read log again, eg. after another process has written it. changes not flushed yet, including any
+            // Put() while reloading, are newer than the log & kept
+            void Reload()
+            {
+                Flush();
+
+                std::unique_lock<std::mutex> lockFile(m_muxFile);
+                std::unique_lock<std::mutex> lock(m_muxState);
+                if (!m_bOpen)
+                    return;
+                if (m_pFile)
+                    std::fclose(m_pFile);
+                m_pFile = nullptr;
+                Recover();
+            }
+
+        private:
+            void FlushLoop()
+            {
+                std::unique_lock<std::mutex> lock(m_muxState);
+                while (!m_bStop)
+                {
+                    m_cvFlush.wait_for(lock, m_flushInterval, [this]()
+                                       { return m_bStop || m_nFlushRequested > m_nFlushed || m_mapDirty.size() >= FLUSH_BATCH; });
+
+                    uint64_t nRequested = m_nFlushRequested;
+                    lock.unlock();
+                    WriteDirty();
+                    lock.lock();
+
+                    m_nFlushed = nRequested;
+                    m_cvFlushed.notify_all();
+                }
+
+                // last chance for anything still dirty
+                lock.unlock();
+                WriteDirty();
+                lock.lock();
+                m_nFlushed = m_nFlushRequested;
+                m_cvFlushed.notify_all();
+            }
+
+            // append one record per dirty key, then compact if log has grown too much. a batch that does not
+            // reach disk whole is kept for the next attempt
+            void WriteDirty()
+            {
+                std::unique_lock<std::mutex> lockFile(m_muxFile);
+
+                size_t nLiveBytes = 0;
+                {
+                    std::unique_lock<std::mutex> lock(m_muxState);
+                    m_mapBatch.swap(m_mapDirty);
+                    nLiveBytes = m_nLiveBytes;
+                }
+                if (m_mapBatch.empty())
+                    return;
+
+                if (!m_pFile && !ReopenLog())
+                {
+                    RequeueBatch();
+                    return;
+                }
+
+                size_t nBytes = 0;
+                bool bOk = true;
+                for (auto it = m_mapBatch.begin(); bOk && it != m_mapBatch.end(); ++it)
+                {
+                    size_t nRecord = WriteRecord(m_pFile, it->first, it->second.get());
+                    nBytes += nRecord;
+                    bOk = nRecord != 0;
+                }
+                bOk = bOk && std::fflush(m_pFile) == 0 && ::fdatasync(::fileno(m_pFile)) == 0;
+
+                if (!bOk)
+                {
+                    // log may now end part way through a record. recovery stops at the first bad one, so it is cut
+                    // back to the last good record before anything else is appended
+                    Log() << "[STATE] Write Failed: " << std::strerror(errno) << "\n";
+                    std::fclose(m_pFile);
+                    m_pFile = nullptr;
+                    m_bTornTail = true;
+                    RequeueBatch();
+                    return;
+                }
+                m_nLogBytes += nBytes;
+                m_mapBatch.clear();
+
+                if (m_nLogBytes > COMPACT_MIN_BYTES && m_nLogBytes > COMPACT_RATIO * nLiveBytes)
+                    Compact();
+            }
+
+            // reopen log for appending after a failure, first cutting off whatever a failed write left behind
+            bool ReopenLog()
+            {
+                if (m_bTornTail)
+                {
+                    if (::truncate(m_sPath.c_str(), off_t(m_nLogBytes)) != 0)
+                        return false;
+                    m_bTornTail = false;
+                }
+                m_pFile = std::fopen(m_sPath.c_str(), "ab");
+                return m_pFile != nullptr;
+            }
+
+            // keep batch for next attempt without overwriting newer changes
+            void RequeueBatch()
+            {
+                std::unique_lock<std::mutex> lock(m_muxState);
+                m_mapDirty.insert(m_mapBatch.begin(), m_mapBatch.end());
+                m_mapBatch.clear();
+            }
+
+            // rewrite log holding only live state, swapped in with an atomic rename
+            void Compact()
+            {
+                std::vector<std::pair<uint64_t, std::shared_ptr<const std::vector<uint8_t>>>> vSnapshot;
+                {
+                    std::unique_lock<std::mutex> lock(m_muxState);
+                    vSnapshot.assign(m_mapState.begin(), m_mapState.end());
+                }
+
+                std::string sTemp = m_sPath + ".tmp";
+                FILE *pFile = std::fopen(sTemp.c_str(), "wb");
+                if (!pFile)
+                    return;
+
+                state_log_header header;
+                bool bOk = std::fwrite(&header, sizeof(header), 1, pFile) == 1;
+                size_t nBytes = sizeof(header);
+                for (auto it = vSnapshot.begin(); bOk && it != vSnapshot.end(); ++it)
+                {
+                    size_t nRecord = WriteRecord(pFile, it->first, it->second.get());
+                    nBytes += nRecord;
+                    bOk = nRecord != 0;
+                }
+
+                bOk = bOk && std::fflush(pFile) == 0 && ::fsync(::fileno(pFile)) == 0;
+                bOk = std::fclose(pFile) == 0 && bOk;
+                if (!bOk || std::rename(sTemp.c_str(), m_sPath.c_str()) != 0)
+                {
+                    std::remove(sTemp.c_str());
+                    return;
+                }
+
+                // rename only survives a crash once the directory holding the log is on disk too
+                SyncDirectory();
+
+                std::fclose(m_pFile);
+                m_pFile = std::fopen(m_sPath.c_str(), "ab");
+                m_nLogBytes = nBytes;
+            }
+
+            // returns bytes written, 0 if the write failed
+            static size_t WriteRecord(FILE *pFile, uint64_t nKey, const std::vector<uint8_t> *pState)
+            {
+                state_log_record record;
+                record.nKey = nKey;
+                record.nSize = pState ? uint32_t(pState->size()) : 0;
+                record.nFlags = pState ? 0 : FLAG_ERASE;
+                record.nChecksum = Checksum(record, pState ? pState->data() : nullptr);
+
+                if (std::fwrite(&record, sizeof(record), 1, pFile) != 1)
+                    return 0;
+                if (record.nSize > 0 && std::fwrite(pState->data(), record.nSize, 1, pFile) != 1)
+                    return 0;
+                return sizeof(record) + record.nSize;
+            }
+
+            void SyncDirectory() const
+            {
+                size_t nSlash = m_sPath.find_last_of('/');
+                std::string sDirectory = nSlash == std::string::npos ? "." : nSlash == 0 ? "/" : m_sPath.substr(0, nSlash);
+                int fd = ::open(sDirectory.c_str(), O_RDONLY | O_DIRECTORY);
+                if (fd < 0)
+                    return;
+                ::fsync(fd);
+                ::close(fd);
+            }
+
+            // FNV-1a over record fields & data, enough to spot a record cut short by a crash
+            static uint32_t Checksum(const state_log_record &record, const uint8_t *pData)
+            {
+                uint32_t nHash = 2166136261u;
+                auto mix = [&nHash](const void *p, size_t n)
+                {
+                    const uint8_t *pBytes = static_cast<const uint8_t *>(p);
+                    for (size_t i = 0; i < n; i++)
+                        nHash = (nHash ^ pBytes[i]) * 16777619u;
+                };
+                mix(&record.nKey, sizeof(record.nKey));
+                mix(&record.nSize, sizeof(record.nSize));
+                mix(&record.nFlags, sizeof(record.nFlags));
+                if (pData)
+                    mix(pData, record.nSize);
+                return nHash;
+            }
+
+            static size_t RecordSize(size_t nSize)
+            {
+                return sizeof(state_log_record) + nSize;
+            }
+
+            // map log & replay it into memory, then open it for appending. dirty keys have not reached the log yet
+            // & are laid over it. caller holds both locks
+            void Recover()
+            {
+                state_log_header header;
+                size_t nValid = 0;
+
+                m_mapState.clear();
+                m_nLiveBytes = 0;
+
+                int fd = ::open(m_sPath.c_str(), O_RDWR);
+                struct stat st = {};
+                if (fd >= 0 && ::fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(header))
+                {
+                    size_t nFileSize = size_t(st.st_size);
+                    void *p = ::mmap(nullptr, nFileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (p == MAP_FAILED)
+                        throw std::runtime_error("unable to map state log " + m_sPath);
+
+                    const uint8_t *pBase = static_cast<const uint8_t *>(p);
+                    if (std::memcmp(pBase, header.sMagic, sizeof(header.sMagic)) != 0)
+                    {
+                        ::munmap(p, nFileSize);
+                        ::close(fd);
+                        throw std::runtime_error("not a state log " + m_sPath);
+                    }
+
+                    // stop at first record that is cut short or fails its checksum
+                    size_t nOffset = sizeof(header);
+                    state_log_record record;
+                    while (nOffset + sizeof(record) <= nFileSize)
+                    {
+                        std::memcpy(&record, pBase + nOffset, sizeof(record));
+                        const uint8_t *pData = pBase + nOffset + sizeof(record);
+                        if (record.nSize > nFileSize - nOffset - sizeof(record) || Checksum(record, pData) != record.nChecksum)
+                            break;
+
+                        if (record.nFlags & FLAG_ERASE)
+                        {
+                            auto it = m_mapState.find(record.nKey);
+                            if (it != m_mapState.end())
+                            {
+                                m_nLiveBytes -= RecordSize(it->second->size());
+                                m_mapState.erase(it);
+                            }
+                        }
+                        else
+                        {
+                            auto &pState = m_mapState[record.nKey];
+                            m_nLiveBytes += RecordSize(record.nSize) - (pState ? RecordSize(pState->size()) : 0);
+                            pState = std::make_shared<const std::vector<uint8_t>>(pData, pData + record.nSize);
+                        }
+                        nOffset += sizeof(record) + record.nSize;
+                    }
+                    nValid = nOffset;
+
+                    ::munmap(p, nFileSize);
+                    if (nValid < nFileSize)
+                    {
+                        Log() << "[STATE] Discarding " << nFileSize - nValid << " bytes of torn log\n";
+                        if (::ftruncate(fd, off_t(nValid)) != 0)
+                            throw std::runtime_error("unable to repair state log " + m_sPath);
+                    }
+                }
+                if (fd >= 0)
+                    ::close(fd);
+
+                if (nValid == 0)
+                {
+                    // new (or empty) log
+                    m_pFile = std::fopen(m_sPath.c_str(), "wb");
+                    if (!m_pFile)
+                        throw std::runtime_error("unable to open state log " + m_sPath);
+                    if (std::fwrite(&header, sizeof(header), 1, m_pFile) != 1 || std::fflush(m_pFile) != 0)
+                        throw std::runtime_error("unable to write state log " + m_sPath);
+                    nValid = sizeof(header);
+                }
+                else
+                {
+                    m_pFile = std::fopen(m_sPath.c_str(), "ab");
+                    if (!m_pFile)
+                        throw std::runtime_error("unable to open state log " + m_sPath);
+                }
+
+                m_nLogBytes = nValid;
+                m_bTornTail = false;
+
+                for (auto &[nKey, pDirty] : m_mapDirty)
+                {
+                    auto it = m_mapState.find(nKey);
+                    if (it != m_mapState.end())
+                    {
+                        m_nLiveBytes -= RecordSize(it->second->size());
+                        m_mapState.erase(it);
+                    }
+                    if (pDirty)
+                    {
+                        m_nLiveBytes += RecordSize(pDirty->size());
+                        m_mapState[nKey] = pDirty;
+                    }
+                }
+                Log() << "[STATE] Recovered " << m_mapState.size() << " Entries\n";
+            }
+
+        private:
+            static constexpr uint32_t FLAG_ERASE = 1;
+
+            // flush early once this many keys are dirty
+            static constexpr size_t FLUSH_BATCH = 4096;
+
+            // compact once log is this much bigger than live state, and not before it is worth it
+            static constexpr size_t COMPACT_RATIO = 4;
+            static constexpr size_t COMPACT_MIN_BYTES = 4 * 1024 * 1024;
+
+            std::string m_sPath;
+            std::chrono::milliseconds m_flushInterval;
+
+            // latest state of every key, and keys changed since last flush (nullptr = erased)
+            mutable std::mutex m_muxState;
+            std::unordered_map<uint64_t, std::shared_ptr<const std::vector<uint8_t>>> m_mapState;
+            std::unordered_map<uint64_t, std::shared_ptr<const std::vector<uint8_t>>> m_mapDirty;
+            size_t m_nLiveBytes = 0;
+
+            // flush thread, flushes asked for & done
+            std::thread m_threadFlush;
+            std::condition_variable m_cvFlush;
+            std::condition_variable m_cvFlushed;
+            uint64_t m_nFlushRequested = 0;
+            uint64_t m_nFlushed = 0;
+            bool m_bStop = false;
+            bool m_bOpen = false;
+
+            // log file, only touched while holding m_muxFile. m_nLogBytes ends at the last record known to be
+            // whole, a failed write may have left more behind it
+            std::mutex m_muxFile;
+            FILE *m_pFile = nullptr;
+            size_t m_nLogBytes = 0;
+            bool m_bTornTail = false;
+            std::unordered_map<uint64_t, std::shared_ptr<const std::vector<uint8_t>>> m_mapBatch;
+        };
+#endif
+    }
+}
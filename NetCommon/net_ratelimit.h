@@ -0,0 +1,146 @@
+#pragma once
+#include "net_common.h"
+
+namespace netp
+{
+    namespace net
+    {
+        // classic token bucket - refills at dRate tokens per second up to dBurst
+        class token_bucket
+        {
+        public:
+            token_bucket() = default;
+
+            token_bucket(double dRate, double dBurst)
+                : m_dRate(dRate), m_dBurst(std::max(dBurst, 1.0)), m_dTokens(m_dBurst)
+            {
+            }
+
+        public:
+            // how long until nTokens are available, zero if they are available now
+            std::chrono::nanoseconds TimeUntil(double nTokens, std::chrono::steady_clock::time_point tpNow)
+            {
+                Refill(tpNow);
+                if (m_dTokens >= nTokens)
+                    return std::chrono::nanoseconds(0);
+
+                // a request larger than the burst can never be met in full, wait for a full bucket
+                double dNeeded = std::min(nTokens, m_dBurst) - m_dTokens;
+                return std::chrono::nanoseconds(int64_t(dNeeded / m_dRate * 1e9) + 1);
+            }
+
+            // take tokens, bucket may go negative for requests larger than burst so they are still paid for
+            void Consume(double nTokens)
+            {
+                m_dTokens -= nTokens;
+            }
+
+        private:
+            void Refill(std::chrono::steady_clock::time_point tpNow)
+            {
+                if (m_tpLast.time_since_epoch().count() != 0)
+                {
+                    std::chrono::duration<double> elapsed = tpNow - m_tpLast;
+                    m_dTokens = std::min(m_dBurst, m_dTokens + elapsed.count() * m_dRate);
+                }
+                m_tpLast = tpNow;
+            }
+
+        private:
+            double m_dRate = 0.0;
+            double m_dBurst = 1.0;
+            double m_dTokens = 1.0;
+            std::chrono::steady_clock::time_point m_tpLast;
+        };
+
+        // what to do with a message that exceeds a client's limits
+        enum class limit_action
+        {
+            drop,      // discard it, keep reading
+            delay,     // stop reading from socket until allowed, client is throttled by TCP backpressure
+            disconnect // treat client as hostile
+        };
+
+        // rate limits shared by all connections of a server. a rate of zero means unlimited
+        template <typename T>
+        struct rate_limits
+        {
+            struct limit
+            {
+                double dRate = 0.0;  // per second
+                double dBurst = 0.0; // allowed in one go, defaults to one second worth
+            };
+
+            limit messages;                      // messages per second, any type
+            limit bytes;                         // bytes per second, headers included
+            std::unordered_map<T, limit> byType; // messages per second of a single message type
+            limit_action nAction = limit_action::drop;
+        };
+
+        // per connection state of the buckets described by a rate_limits
+        template <typename T>
+        class rate_limiter
+        {
+        public:
+            void Configure(std::shared_ptr<const rate_limits<T>> pLimits)
+            {
+                m_pLimits = pLimits;
+                m_bucketMessages = MakeBucket(pLimits->messages);
+                m_bucketBytes = MakeBucket(pLimits->bytes);
+                m_mapBuckets.clear();
+            }
+
+            bool IsEnabled() const
+            {
+                return m_pLimits != nullptr;
+            }
+
+            limit_action Action() const
+            {
+                return m_pLimits->nAction;
+            }
+
+            // zero if message may pass now (its tokens are taken), otherwise how long it would have to wait
+            std::chrono::nanoseconds Admit(T id, size_t nBytes, std::chrono::steady_clock::time_point tpNow)
+            {
+                std::chrono::nanoseconds wait(0);
+                token_bucket *pType = nullptr;
+
+                auto it = m_pLimits->byType.find(id);
+                if (it != m_pLimits->byType.end() && it->second.dRate > 0.0)
+                {
+                    auto itBucket = m_mapBuckets.find(id);
+                    if (itBucket == m_mapBuckets.end())
+                        itBucket = m_mapBuckets.emplace(id, MakeBucket(it->second)).first;
+                    pType = &itBucket->second;
+                    wait = std::max(wait, pType->TimeUntil(1.0, tpNow));
+                }
+                if (m_pLimits->messages.dRate > 0.0)
+                    wait = std::max(wait, m_bucketMessages.TimeUntil(1.0, tpNow));
+                if (m_pLimits->bytes.dRate > 0.0)
+                    wait = std::max(wait, m_bucketBytes.TimeUntil(double(nBytes), tpNow));
+
+                if (wait.count() > 0)
+                    return wait;
+
+                if (pType)
+                    pType->Consume(1.0);
+                m_bucketMessages.Consume(1.0);
+                m_bucketBytes.Consume(double(nBytes));
+                return wait;
+            }
+
+        private:
+            static token_bucket MakeBucket(const typename rate_limits<T>::limit &l)
+            {
+                return token_bucket(l.dRate, l.dBurst > 0.0 ? l.dBurst : l.dRate);
+            }
+
+        private:
+            std::shared_ptr<const rate_limits<T>> m_pLimits;
+            token_bucket m_bucketMessages;
+            token_bucket m_bucketBytes;
+            std::unordered_map<T, token_bucket> m_mapBuckets;
+        };
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+#include "net_capture.h"
+#include "net_connection.h"
+#include "net_server.h"
+
+namespace netp
+{
+    namespace net
+    {
+        // feeds a capture recorded with server_interface::EnableCapture back through a server's handlers,
+        // so real traffic patterns can be reproduced & profiled offline. runs on the calling thread,
+        // which acts as the game thread - do not call server.Update() elsewhere meanwhile
+        template <typename T>
+        class capture_replayer
+        {
+        public:
+            capture_replayer(server_interface<T> &server)
+                : m_server(server)
+            {
+            }
+
+        public:
+            // dSpeed 1.0 keeps original timing, 2.0 runs twice as fast, 0 replays as fast as possible.
+            // returns number of messages replayed
+            size_t Replay(const std::string &sPath, double dSpeed = 1.0)
+            {
+                // clients leave after their last captured message, as far as the capture tells
+                std::unordered_map<uint32_t, size_t> mapLast = FindLastMessages(sPath);
+
+                capture_reader<T> reader(sPath);
+                capture_record record;
+                owned_message<T> msg;
+                size_t nMessages = 0;
+
+                auto tpStart = std::chrono::steady_clock::now();
+                while (reader.Next(record, msg.msg))
+                {
+                    if (dSpeed > 0.0)
+                    {
+                        auto tpDue = tpStart + std::chrono::nanoseconds(int64_t(double(record.nTimestamp) / dSpeed));
+                        if (tpDue > std::chrono::steady_clock::now())
+                        {
+                            // catch handlers up before going idle, as the real game thread would
+                            Pump();
+                            std::this_thread::sleep_until(tpDue);
+                        }
+                    }
+
+                    auto client = GetConnection(record.nConnection);
+                    msg.remote = client;
+                    m_server.InjectMessage(msg);
+                    if (mapLast[record.nConnection] == nMessages)
+                        m_vLeaving.push_back(client);
+                    nMessages++;
+
+                    // keep queue short, so handlers see the same message pacing as in capture
+                    if (nMessages % 64 == 0)
+                        Pump();
+                }
+
+                Pump();
+                return nMessages;
+            }
+
+        private:
+            // stand in for a captured connection - counts as connected until its last captured message has been
+            // handled, so broadcasts & MessageClient() reach it. it has no socket, anything sent to it is dropped
+            class replay_connection : public connection<T>
+            {
+            public:
+                replay_connection(asio::io_context &asioContext, tsqueue<owned_message<T>> &qIn, uint32_t uid)
+                    : connection<T>(connection<T>::owner::server, asioContext, asio::ip::tcp::socket(asioContext), qIn)
+                {
+                    this->id = uid;
+                }
+
+                bool IsConnected() const override
+                {
+                    return !m_bLeft;
+                }
+
+                void Leave()
+                {
+                    m_bLeft = true;
+                }
+
+            private:
+                bool m_bLeft = false;
+            };
+
+            // index of each connection's last message in the capture
+            static std::unordered_map<uint32_t, size_t> FindLastMessages(const std::string &sPath)
+            {
+                capture_reader<T> reader(sPath);
+                capture_record record;
+                message<T> msg;
+                std::unordered_map<uint32_t, size_t> mapLast;
+                for (size_t nMessage = 0; reader.Next(record, msg); nMessage++)
+                    mapLast[record.nConnection] = nMessage;
+                return mapLast;
+            }
+
+            std::shared_ptr<replay_connection> GetConnection(uint32_t nConnection)
+            {
+                auto it = m_mapConnections.find(nConnection);
+                if (it != m_mapConnections.end())
+                    return it->second;
+
+                // first time this client is seen, it joins the server's connections & application sets up its state
+                auto client = std::make_shared<replay_connection>(m_context, m_qUnused, nConnection);
+                m_mapConnections[nConnection] = client;
+                m_server.InjectConnection(client);
+                m_server.OnClientValidated(client);
+                return client;
+            }
+
+            void Pump()
+            {
+                m_server.Update(-1, false);
+
+                // last messages of leaving clients have been handled, now they disconnect
+                if (!m_vLeaving.empty())
+                {
+                    for (auto &client : m_vLeaving)
+                    {
+                        client->Leave();
+                        m_server.InjectDisconnect(client);
+                    }
+                    m_vLeaving.clear();
+                    m_server.Update(-1, false);
+                }
+
+                // run sends posted by handlers, which simply discard their messages
+                m_context.restart();
+                m_context.poll();
+            }
+
+        private:
+            server_interface<T> &m_server;
+            asio::io_context m_context;
+            tsqueue<owned_message<T>> m_qUnused;
+            std::unordered_map<uint32_t, std::shared_ptr<replay_connection>> m_mapConnections;
+            std::vector<std::shared_ptr<replay_connection>> m_vLeaving;
+        };
+    }
+}
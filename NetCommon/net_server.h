@@ -4,6 +4,11 @@
 #include "net_tsqueue.h"
 #include "net_message.h"
 #include "net_connection.h"
+#include "net_timer.h"
+#include "net_entity.h"
+#include "net_handoff.h"
+#include "net_persist.h"
+#include "net_connset.h"
 
 namespace netp
 {
@@ -14,20 +19,45 @@ namespace netp
         {
         public:
             server_interface(uint16_t port)
-                : m_asioAcceptor(m_asioContext, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
+                : m_asioAcceptor(m_asioContext), m_nPort(port),
+                  m_timerWheel(m_asioContext), m_timingWheel(std::chrono::milliseconds(100))
             {
             }
 
             virtual ~server_interface()
             {
                 Stop();
+
+                // connections own sockets of m_asioContext, let them go while it still exists
+                m_connections.Clear();
+                m_qAccepted.clear();
+                m_qMessagesIn.clear();
+                m_deqBatch.clear();
             }
 
             bool Start()
             {
                 try
                 {
+                    // listening socket may already have been handed over by AdoptFrom()
+                    if (!m_asioAcceptor.is_open())
+                    {
+                        asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), m_nPort);
+                        m_asioAcceptor.open(endpoint.protocol());
+                        m_asioAcceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+                        m_asioAcceptor.bind(endpoint);
+                        m_asioAcceptor.listen();
+                    }
+
+#ifndef _WIN32
+                    // already open if adopted
+                    if (m_pState)
+                        m_pState->Open();
+#endif
+
+                    m_bAccepting = true;
                     WaitForClientConnection();
+                    WaitForWheelTick();
 
                     m_threadContext = std::thread([this]()
                                                   { m_asioContext.run(); });
@@ -38,7 +68,7 @@ namespace netp
                     return false;
                 }
 
-                std::cout << "[SERVER] Started!\n";
+                Log() << "[SERVER] Started!\n";
                 return true;
             }
 
@@ -51,7 +81,7 @@ namespace netp
                 if (m_threadContext.joinable())
                     m_threadContext.join();
 
-                std::cout << "[SERVER] Stopped!\n";
+                Log() << "[SERVER] Stopped!\n";
             }
 
             // ASYNC - instruct asio to wait for connection
@@ -62,7 +92,7 @@ namespace netp
 
                     if (!ec)
                     {
-                        std::cout << "[SERVER] New Connection: " << socket.remote_endpoint() << "\n";
+                        Log() << "[SERVER] New Connection: " << socket.remote_endpoint() << "\n";
 
                         std::shared_ptr<connection<T>> newconn =
                             std::make_shared<connection<T>>(connection<T>::owner::server,
@@ -71,66 +101,79 @@ namespace netp
                         // give user chance to deny connection
                         if (OnClientConnect(newconn))
                         {
-                            //connection allowed, add to container of new connections
-                            m_deqConnections.push_back(std::move(newconn));
+                            //connection allowed, game thread adds it to container of connections on next Update()
+                            ApplyConnectionSettings(newconn);
+                            newconn->ConnectToClient(this, nIDCounter++);
+                            m_qAccepted.push_back(newconn);
 
-                            m_deqConnections.back()->ConnectToClient(this, nIDCounter++);
+                            // every connection gets a timer, even before validation, so half-open sockets are reaped
+                            m_timingWheel.Schedule(FirstTimerDelay(), newconn);
 
-                            std::cout << "[" << m_deqConnections.back()->GetID() << "] Connection Approved\n";
+                            Log() << "[" << newconn->GetID() << "] Connection Approved\n";
                         }
                         else
                         {
-                            std::cout << "[----] Connection Denied\n";
+                            Log() << "[----] Connection Denied\n";
                         }
                     }
-                    else{
+                    else if (m_bAccepting)
+                    {
                         //error has occured during acceptance
-                        std::cout << "[SERVER] New Connection Error: " << ec.message() << "\n";
+                        Log() << "[SERVER] New Connection Error: " << ec.message() << "\n";
                     }
 
                     //prime asio context with more work - simply wait again for another connection
-                    WaitForClientConnection(); });
+                    if (m_bAccepting)
+                        WaitForClientConnection(); });
             }
 
-            // send message to specific client
-            void MessageClient(std::shared_ptr<connection<T>> client, const message<T> &msg)
+            // send message to specific client. like all Message* functions, safe from any thread
+            void MessageClient(std::shared_ptr<connection<T>> client, const message<T> &msg, priority nPriority = priority::normal)
             {
                 if (client && client->IsConnected())
                 {
-                    client->Send(msg);
+                    client->Send(msg, nPriority);
                 }
-                else
+                else if (client && !client->IsRemoved())
                 {
-                    OnClientDisconnect(client);
-                    client.reset();
-                    m_deqConnections.erase(
-                        std::remove(m_deqConnections.begin(), m_deqConnections.end(), client), m_deqConnections.end());
+                    // client couldnt be contacted, game thread removes it on next Update()
+                    m_qReaped.push_back(client);
                 }
             }
 
-            // send message to all clients
-            void MessageAllClients(const message<T> &msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr)
+#ifndef _WIN32
+            // stream file at sPath to client in chunks alongside its messages, the client stores it as sName in
+            // its stream directory, see connection::SendFile(). safe from any thread, returns 0 if not sent
+            uint32_t StreamFileToClient(std::shared_ptr<connection<T>> client, T nID, const std::string &sPath, const std::string &sName = {})
             {
-                bool bInvalidClientExists = false;
-                for (auto &client : m_deqConnections)
+                if (client && client->IsConnected())
+                    return client->SendFile(nID, sPath, sName);
+
+                if (client && !client->IsRemoved())
+                    m_qReaped.push_back(client);
+                return 0;
+            }
+#endif
+
+            // send message to every client in a list of connection IDs, eg. an interest list from BuildInterestLists()
+            void MessageClients(const std::vector<uint32_t> &vIDs, const message<T> &msg, priority nPriority = priority::normal)
+            {
+                auto connections = m_connections.Read();
+                for (uint32_t nID : vIDs)
                 {
-                    // check client is connected...
-                    if (client && client->IsConnected())
-                    {
-                        if (client != pIgnoreClient)
-                            client->Send(msg);
-                    }
-                    else
-                    {
-                        // The client couldnt be contacted, so assume it has disconnected
-                        OnClientDisconnect(client);
-                        client.reset();
-                        bInvalidClientExists = true;
-                    }
+                    if (auto client = connections.Find(nID))
+                        MessageClient(client, msg, nPriority);
                 }
+            }
 
-                if (bInvalidClientExists)
-                    m_deqConnections.erase(std::remove(m_deqConnections.begin(), m_deqConnections.end(), nullptr), m_deqConnections.end());
+            // send message to all clients
+            void MessageAllClients(const message<T> &msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr, priority nPriority = priority::normal)
+            {
+                for (auto &client : m_connections.Read())
+                {
+                    if (client != pIgnoreClient)
+                        MessageClient(client, msg, nPriority);
+                }
             }
 
             void Update(size_t nMaxMessages = -1, bool bWait = false)
@@ -139,17 +182,596 @@ namespace netp
                 if (bWait)
                     m_qMessagesIn.wait();
 
+                // connections expired by the timing wheel are removed here, on the game thread
+                ReapConnections();
+
+                // take messages in batches so the queue lock is not taken per message, like the client does.
+                // a sampled message's dispatch stage is then its wait behind the rest of its batch
                 size_t nMessageCount = 0;
-                while (nMessageCount < nMaxMessages && !m_qMessagesIn.empty())
+                while (nMessageCount < nMaxMessages && m_qMessagesIn.drain(m_deqBatch, std::min<size_t>(nMaxMessages - nMessageCount, 64)) > 0)
                 {
-                    // grab front message
-                    auto msg = m_qMessagesIn.pop_front();
+                    int64_t nDequeue = m_pTracer ? TraceNow() : 0;
+                    while (!m_deqBatch.empty())
+                    {
+                        auto &msg = m_deqBatch.front();
+                        if (msg.trace.nRead != 0 && m_pTracer)
+                        {
+                            int64_t nHandlerStart = TraceNow();
+                            OnMessage(msg.remote, msg.msg);
+                            m_pTracer->RecordInbound(msg.trace, nDequeue, nHandlerStart, TraceNow());
+                        }
+                        else
+                        {
+                            // pass to message handler
+                            OnMessage(msg.remote, msg.msg);
+                        }
 
-                    // pass to message handler
-                    OnMessage(msg.remote, msg.msg);
+                        m_deqBatch.pop_front();
+                        nMessageCount++;
+                    }
+                }
+            }
+
+            // as above, but waits at most waitFor for a message to arrive
+            void Update(size_t nMaxMessages, std::chrono::milliseconds waitFor)
+            {
+                m_qMessagesIn.wait_for(waitFor);
+                Update(nMaxMessages, false);
+            }
+
+            // graceful shutdown: stop accepting & reading, give queued messages up to timeout to reach
+            // clients, then close every connection after its last byte and stop. game thread, blocks until done
+            void Drain(std::chrono::milliseconds timeout)
+            {
+                DrainConnections(timeout, nullptr);
+            }
+
+            // as above, first telling every client msgNotice (eg. "server restarting")
+            void Drain(std::chrono::milliseconds timeout, const message<T> &msgNotice)
+            {
+                DrainConnections(timeout, &msgNotice);
+            }
+
+#ifndef _WIN32
+            // hot restart: hand listening socket & live connections over to a new process waiting in AdoptFrom(sPath),
+            // clients keep their TCP connections. queued messages get up to timeout to go out first, connections
+            // that cannot be carried over are closed & their clients reconnect. game thread, server is stopped after
+            bool HandoffTo(const std::string &sPath, std::chrono::milliseconds timeout = std::chrono::seconds(5))
+            {
+                int nSocket = handoff::Connect(sPath);
+                if (nSocket < 0)
+                {
+                    Log() << "[SERVER] Handoff Failed: nobody waiting on " << sPath << "\n";
+                    return false;
+                }
 
-                    nMessageCount++;
+                RunOnContext([this]()
+                             {
+                    m_bAccepting = false;
+                    asio::error_code ec;
+                    m_asioAcceptor.cancel(ec); });
+
+                // nothing more is accepted, take in the last connections that were
+                ReapConnections();
+                auto vConnections = m_connections.Copy();
+                RunOnContext([&vConnections]()
+                             {
+                    for (auto &client : vConnections)
+                        client->StopReading(); });
+
+                // messages already parsed are still handled here, their replies flushed before handing over
+                FlushConnections(vConnections, std::chrono::steady_clock::now() + timeout);
+
+                // new process opens player state log once handoff arrives, it has to be on disk & ours closed by then
+                if (m_pState)
+                    m_pState->Close();
+
+                // cancelled reads complete before the handoff itself runs, so receive buffers are final
+                RunOnContext([&vConnections]()
+                             {
+                    for (auto &client : vConnections)
+                        client->CancelReads(); });
+
+                bool bHeaderSent = false;
+                size_t nHanded = RunOnContext([this, nSocket, &vConnections, &bHeaderSent]()
+                                              {
+                    std::vector<handoff_record> vRecords;
+                    std::vector<std::vector<uint8_t>> vLeftovers;
+                    std::vector<int> vSockets;
+                    for (auto &client : vConnections)
+                    {
+                        handoff_record record;
+                        std::vector<uint8_t> vLeftover;
+                        int fd = client->Detach(record, vLeftover);
+                        if (fd < 0)
+                            continue;
+
+                        vRecords.push_back(record);
+                        vLeftovers.push_back(std::move(vLeftover));
+                        vSockets.push_back(fd);
+                    }
+
+                    handoff_header header;
+                    header.nConnections = uint32_t(vRecords.size());
+                    header.nNextID = nIDCounter;
+                    bool bOk = handoff::Send(nSocket, &header, sizeof(header), m_asioAcceptor.native_handle());
+                    bHeaderSent = bOk;
+
+                    std::vector<uint8_t> vPacket;
+                    for (size_t i = 0; i < vRecords.size(); i++)
+                    {
+                        vPacket.resize(sizeof(handoff_record) + vLeftovers[i].size());
+                        std::memcpy(vPacket.data(), &vRecords[i], sizeof(handoff_record));
+                        if (!vLeftovers[i].empty())
+                            std::memcpy(vPacket.data() + sizeof(handoff_record), vLeftovers[i].data(), vLeftovers[i].size());
+
+                        bOk = bOk && handoff::Send(nSocket, vPacket.data(), vPacket.size(), vSockets[i]);
+
+                        // receiver holds its own copy of the descriptor now
+                        ::close(vSockets[i]);
+                    }
+
+                    asio::error_code ec;
+                    m_asioAcceptor.close(ec);
+                    return bOk ? vRecords.size() : size_t(-1); });
+
+                ::close(nSocket);
+                Stop();
+
+                if (nHanded == size_t(-1))
+                {
+                    // new process never got to open player state, so it is still ours to write
+                    if (m_pState && !bHeaderSent)
+                        m_pState->Open();
+                    Log() << "[SERVER] Handoff Failed: connection to new process lost\n";
+                    return false;
                 }
+
+                Log() << "[SERVER] Handed Off " << nHanded << " of " << vConnections.size() << " Connections\n";
+                return true;
+            }
+
+            // hot restart: wait for a running server to call HandoffTo(sPath), then continue with its listening socket
+            // & clients instead of binding port. call after configuring, before Start(). blocks until handoff arrives
+            bool AdoptFrom(const std::string &sPath)
+            {
+                int nListen = handoff::Listen(sPath);
+                if (nListen < 0)
+                {
+                    Log() << "[SERVER] Adopt Failed: cannot listen on " << sPath << "\n";
+                    return false;
+                }
+
+                Log() << "[SERVER] Waiting For Handoff On " << sPath << "\n";
+                int nSocket = ::accept(nListen, nullptr, nullptr);
+                ::close(nListen);
+                ::unlink(sPath.c_str());
+                if (nSocket < 0)
+                    return false;
+
+                std::vector<uint8_t> vPacket;
+                int fd = -1;
+                handoff_header header;
+                if (!handoff::Receive(nSocket, vPacket, fd) || vPacket.size() != sizeof(handoff_header) || fd < 0 ||
+                    std::memcmp(vPacket.data(), header.sMagic, sizeof(header.sMagic)) != 0)
+                {
+                    Log() << "[SERVER] Adopt Failed: bad handoff\n";
+                    if (fd >= 0)
+                        ::close(fd);
+                    ::close(nSocket);
+                    return false;
+                }
+
+                std::memcpy(&header, vPacket.data(), sizeof(header));
+                try
+                {
+                    m_asioAcceptor.assign(asio::ip::tcp::v4(), fd);
+                    fd = -1;
+
+                    // old process closed player state log just before sending header, it is ours now
+                    if (m_pState)
+                        m_pState->Open();
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "[SERVER] Exception: " << e.what() << '\n';
+                    if (fd >= 0)
+                        ::close(fd);
+                    ::close(nSocket);
+                    return false;
+                }
+                nIDCounter = std::max(nIDCounter, header.nNextID);
+
+                std::vector<std::shared_ptr<connection<T>>> vAdopted;
+                for (uint32_t i = 0; i < header.nConnections; i++)
+                {
+                    if (!handoff::Receive(nSocket, vPacket, fd))
+                        break;
+
+                    handoff_record record;
+                    if (fd < 0 || vPacket.size() < sizeof(handoff_record))
+                    {
+                        if (fd >= 0)
+                            ::close(fd);
+                        continue;
+                    }
+                    std::memcpy(&record, vPacket.data(), sizeof(record));
+
+                    asio::ip::tcp::socket socket(m_asioContext);
+                    socket.assign(asio::ip::tcp::v4(), fd);
+
+                    auto client = std::make_shared<connection<T>>(connection<T>::owner::server,
+                                                                  m_asioContext, std::move(socket), m_qMessagesIn);
+                    ApplyConnectionSettings(client);
+                    client->Adopt(record, vPacket.data() + sizeof(handoff_record));
+
+                    vAdopted.push_back(client);
+                    if (client->GetSessionToken() != 0)
+                        m_mapSessions[client->GetSessionToken()] = client;
+                    m_timingWheel.Schedule(FirstTimerDelay(), client);
+
+                    // application rebuilds whatever it keeps per client
+                    OnClientValidated(client);
+                }
+                m_connections.Add(vAdopted);
+
+                ::close(nSocket);
+                Log() << "[SERVER] Adopted " << vAdopted.size() << " Connections\n";
+                return true;
+            }
+#endif
+
+            // disconnect clients that have sent nothing for this long, zero disables
+            void SetIdleTimeout(std::chrono::milliseconds timeout)
+            {
+                m_idleTimeout = timeout;
+            }
+
+            // send msg to clients that have sent nothing for this long, zero disables. based on what is read, not
+            // written, so a client that only receives broadcasts is still asked to answer before it idles out
+            void SetHeartbeat(std::chrono::milliseconds interval, const message<T> &msg)
+            {
+                m_heartbeatInterval = interval;
+                m_msgHeartbeat = msg;
+            }
+
+            // keep sessions of clients whose socket fails for up to grace, replaying up to nMessages
+            // they missed when they reconnect. must be set before Start()
+            void EnableSessionResume(std::chrono::milliseconds grace, size_t nMessages = 1024)
+            {
+                m_sessionGrace = grace;
+                m_nReplayLimit = nMessages;
+            }
+
+            // per client limits on what may be sent to server, applied to connections accepted from now on
+            void SetRateLimits(const rate_limits<T> &limits)
+            {
+                m_pRateLimits = std::make_shared<const rate_limits<T>>(limits);
+            }
+
+            // nodelay, buffer sizes etc. for connections accepted from now on
+            void SetSocketOptions(const socket_options &options)
+            {
+                m_socketOptions = options;
+            }
+
+            // largest message a client may send, anything bigger gets it disconnected
+            void SetMaxMessageSize(uint32_t nBytes)
+            {
+                m_nMaxMessageSize = nBytes;
+            }
+
+#ifndef _WIN32
+            // bytes of file data per chunk of StreamFileToClient() for connections accepted from now on. smaller
+            // chunks let messages in sooner, larger ones cost fewer system calls
+            void SetStreamChunkSize(size_t nBytes)
+            {
+                m_nStreamChunkSize = nBytes;
+            }
+#endif
+
+            // record all inbound messages from connections accepted from now on to a capture file,
+            // which capture_replayer can feed back into a server later. must be set before Start()
+            void EnableCapture(const std::string &sPath)
+            {
+                m_pCapture = std::make_unique<capture_writer>(sPath, sizeof(message_header<T>));
+            }
+
+#ifdef NETP_USE_TLS
+            // connections accepted from now on talk TLS, pContext must be a server context with a certificate
+            void EnableTls(std::shared_ptr<tls_context> pContext)
+            {
+                m_pTlsContext = std::move(pContext);
+            }
+#endif
+
+            // trace 1 in nSampleEvery messages through the pipeline of connections accepted from now on,
+            // see GetTracer() for the histograms. must be set before Start()
+            void EnableTracing(uint32_t nSampleEvery = 64)
+            {
+                m_pTracer = std::make_unique<message_tracer>(nSampleEvery);
+            }
+
+            // nullptr unless EnableTracing() was called
+            message_tracer *GetTracer()
+            {
+                return m_pTracer.get();
+            }
+
+#ifndef _WIN32
+            // keep per player state in m_pState, a write-behind log at sPath that is recovered on Start(), or once
+            // the handoff arrives in AdoptFrom() so only one process writes it at a time. handlers Put() state without
+            // waiting for disk. must be set before Start() / AdoptFrom()
+            void EnablePersistence(const std::string &sPath, std::chrono::milliseconds flushInterval = std::chrono::seconds(1))
+            {
+                m_pState = std::make_unique<state_store>(sPath, flushInterval, false);
+            }
+#endif
+
+            // hand a message to the game thread as if it had arrived from msg.remote, eg. for replays
+            void InjectMessage(const owned_message<T> &msg)
+            {
+                m_qMessagesIn.push_back(msg);
+            }
+
+            // a connection made outside the acceptor, eg. a replay stand-in, joins the connection set on next
+            // Update() as an accepted one would. it gets no timer, whoever made it decides when it leaves
+            void InjectConnection(std::shared_ptr<connection<T>> client)
+            {
+                m_qAccepted.push_back(std::move(client));
+            }
+
+            // game thread removes an injected connection on next Update(), telling application it disconnected
+            void InjectDisconnect(std::shared_ptr<connection<T>> client)
+            {
+                if (client && !client->IsRemoved())
+                    m_qReaped.push_back(std::move(client));
+            }
+
+        private:
+            // settings every connection gets from its server, whether accepted or adopted
+            void ApplyConnectionSettings(const std::shared_ptr<connection<T>> &client)
+            {
+                client->EnableResume(m_nReplayLimit);
+                client->SetCapture(m_pCapture.get());
+                client->SetTracer(m_pTracer.get());
+#ifdef NETP_USE_TLS
+                client->SetTls(m_pTlsContext);
+#endif
+                client->SetMaxMessageSize(m_nMaxMessageSize);
+                client->SetRateLimits(m_pRateLimits);
+#ifndef _WIN32
+                client->SetChunkSize(m_nStreamChunkSize);
+#endif
+
+                if (!client->SetSocketOptions(m_socketOptions) && !m_bSocketOptionsRefused)
+                {
+                    Log() << "[SERVER] Some Socket Options Refused\n";
+                    m_bSocketOptionsRefused = true;
+                }
+            }
+
+            // run func on asio thread & wait for its result, directly if context is not running
+            template <typename Func>
+            auto RunOnContext(Func func) -> decltype(func())
+            {
+                if (!m_threadContext.joinable() || m_asioContext.stopped())
+                    return func();
+
+                std::packaged_task<decltype(func())()> task(std::move(func));
+                auto future = task.get_future();
+                asio::post(m_asioContext, [&task]()
+                           { task(); });
+                return future.get();
+            }
+
+            // keep handling messages until every connection has written out its queue, or deadline
+            void FlushConnections(const std::vector<std::shared_ptr<connection<T>>> &vConnections,
+                                  std::chrono::steady_clock::time_point tpDeadline)
+            {
+                while (true)
+                {
+                    Update(-1, false);
+
+                    bool bPending = RunOnContext([&vConnections]()
+                                                 {
+                        for (auto &client : vConnections)
+                            if (client->HasPendingWrites())
+                                return true;
+                        return false; });
+
+                    if ((!bPending && m_qMessagesIn.empty()) || std::chrono::steady_clock::now() >= tpDeadline)
+                        break;
+
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+            }
+
+            void DrainConnections(std::chrono::milliseconds timeout, const message<T> *pNotice)
+            {
+                auto tpDeadline = std::chrono::steady_clock::now() + timeout;
+                RunOnContext([this]()
+                             {
+                    m_bAccepting = false;
+                    asio::error_code ec;
+                    m_asioAcceptor.close(ec); });
+
+                ReapConnections();
+                auto vConnections = m_connections.Copy();
+                Log() << "[SERVER] Draining " << vConnections.size() << " Connections\n";
+                RunOnContext([&vConnections]()
+                             {
+                    for (auto &client : vConnections)
+                        client->StopReading(); });
+
+                if (pNotice)
+                    MessageAllClients(*pNotice, nullptr, priority::high);
+
+                FlushConnections(vConnections, tpDeadline);
+
+                RunOnContext([&vConnections]()
+                             {
+                    for (auto &client : vConnections)
+                        client->Shutdown(); });
+
+                // wait for clients to close their side, whatever is left at deadline is simply closed
+                while (std::chrono::steady_clock::now() < tpDeadline)
+                {
+                    bool bOpen = RunOnContext([&vConnections]()
+                                              {
+                        for (auto &client : vConnections)
+                            if (client->IsConnected())
+                                return true;
+                        return false; });
+                    if (!bOpen)
+                        break;
+
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+
+                // application sees every client leave, eg. to save their state
+                for (auto &client : vConnections)
+                    NotifyDisconnect(client);
+                m_connections.Clear();
+
+#ifndef _WIN32
+                if (m_pState)
+                    m_pState->Flush();
+#endif
+
+                Stop();
+            }
+
+            // ASYNC - drive timing wheel from asio thread
+            void WaitForWheelTick()
+            {
+                m_timerWheel.expires_after(m_timingWheel.TickInterval());
+                m_timerWheel.async_wait([this](std::error_code ec)
+                                        {
+                    if (ec)
+                        return;
+
+                    m_vExpiredTimers.clear();
+                    m_timingWheel.Advance(m_vExpiredTimers);
+
+                    for (auto &weakClient : m_vExpiredTimers)
+                    {
+                        if (auto client = weakClient.lock())
+                            CheckConnectionTimers(client);
+                    }
+
+                    // bound how much capture is lost if process dies
+                    if (m_pCapture)
+                        m_pCapture->Flush();
+
+                    WaitForWheelTick(); });
+            }
+
+            // timer fired for client, close it if idle or dead, else heartbeat & re-arm
+            void CheckConnectionTimers(std::shared_ptr<connection<T>> client)
+            {
+                if (client->IsRemoved())
+                    return;
+
+                auto tpNow = std::chrono::steady_clock::now();
+
+                // suspended sessions only wait out their grace period, nothing can be read or written
+                bool bExpired = false;
+                if (client->IsSuspended())
+                {
+                    auto tpGraceEnd = client->GetSuspendedTime() + m_sessionGrace;
+                    if (tpNow < tpGraceEnd)
+                    {
+                        m_timingWheel.Schedule(std::chrono::duration_cast<std::chrono::milliseconds>(tpGraceEnd - tpNow), client);
+                        return;
+                    }
+
+                    Log() << "[" << client->GetID() << "] Session Expired\n";
+                    bExpired = true;
+                }
+
+                bool bIdle = !bExpired && m_idleTimeout.count() > 0 && tpNow - client->GetLastReadTime() >= m_idleTimeout;
+
+                if (!client->IsConnected() || bIdle || bExpired)
+                {
+                    if (bIdle)
+                        Log() << "[" << client->GetID() << "] Idle Timeout\n";
+                    client->Disconnect();
+
+                    // session can no longer be resumed
+                    m_mapSessions.erase(client->GetSessionToken());
+
+                    // hand over to game thread, removed in batch on next Update()
+                    m_qReaped.push_back(client);
+                    return;
+                }
+
+                auto tpNext = tpNow + FirstTimerDelay();
+                if (m_idleTimeout.count() > 0)
+                    tpNext = std::min(tpNext, client->GetLastReadTime() + m_idleTimeout);
+
+                if (m_heartbeatInterval.count() > 0)
+                {
+                    // while client stays silent, ask again once per interval
+                    auto tpHeartbeat = client->GetLastReadTime() + m_heartbeatInterval;
+                    if (tpNow >= tpHeartbeat)
+                    {
+                        client->Send(m_msgHeartbeat, priority::high);
+                        tpHeartbeat = tpNow + m_heartbeatInterval;
+                    }
+                    tpNext = std::min(tpNext, tpHeartbeat);
+                }
+
+                m_timingWheel.Schedule(std::chrono::duration_cast<std::chrono::milliseconds>(tpNext - tpNow), client);
+            }
+
+            // delay until a connection's timer should next be looked at
+            std::chrono::milliseconds FirstTimerDelay() const
+            {
+                // dead sockets are still noticed within a few seconds when no timeouts are configured
+                std::chrono::milliseconds delay(5000);
+                if (m_idleTimeout.count() > 0)
+                    delay = std::min(delay, m_idleTimeout);
+                if (m_heartbeatInterval.count() > 0)
+                    delay = std::min(delay, m_heartbeatInterval);
+                if (m_sessionGrace.count() > 0)
+                    delay = std::min(delay, m_sessionGrace);
+                return delay;
+            }
+
+            // first path to notice client is gone tells application & drops its game state
+            void NotifyDisconnect(std::shared_ptr<connection<T>> client)
+            {
+                if (!client->MarkRemoved())
+                    return;
+
+                OnClientDisconnect(client);
+                m_entities.Remove(client->GetID());
+            }
+
+            // add newly accepted connections & remove expired ones, notifying application once per
+            // connection. the whole batch becomes one new version of the connection set. a removed connection
+            // is freed by whoever lets go of it last, eg. a queued handler or message, not by the set
+            void ReapConnections()
+            {
+                if (m_qAccepted.empty() && m_qReaped.empty())
+                    return;
+
+                while (!m_qAccepted.empty())
+                    m_vAccepted.push_back(m_qAccepted.pop_front());
+
+                while (!m_qReaped.empty())
+                {
+                    auto client = m_qReaped.pop_front();
+                    NotifyDisconnect(client);
+
+                    // closed on asio thread. handlers & queued messages hold their own reference to it
+                    client->Disconnect();
+                }
+
+                m_connections.Update(m_vAccepted, [](const std::shared_ptr<connection<T>> &client)
+                                     { return client->IsRemoved(); });
+                m_vAccepted.clear();
             }
 
         protected:
@@ -175,22 +797,115 @@ namespace netp
             {
             }
 
+            // called from asio thread when a new session is validated, returns its token (0 if resumption disabled)
+            uint64_t RegisterSession(std::shared_ptr<connection<T>> client)
+            {
+                if (m_nReplayLimit == 0)
+                    return 0;
+
+                uint64_t nToken = 0;
+                while (nToken == 0 || m_mapSessions.count(nToken))
+                    nToken = m_rngSessions();
+
+                m_mapSessions[nToken] = client;
+                return nToken;
+            }
+
+            // called from asio thread when a validated client presents a session token
+            bool ResumeSession(uint64_t nToken, uint64_t nLastSequence, connection<T> &from)
+            {
+                auto it = m_mapSessions.find(nToken);
+                if (it == m_mapSessions.end())
+                    return false;
+
+                auto client = it->second.lock();
+                if (!client || client->IsRemoved() || !client->IsSuspended())
+                    return false;
+
+                if (!client->Resume(from, nLastSequence))
+                {
+                    // client is too far behind, its old session is useless - drop it & start afresh
+                    m_mapSessions.erase(it);
+                    client->Disconnect();
+                    return false;
+                }
+
+                // new connection was never validated, leave the set without telling the application about it
+                from.MarkRemoved();
+                m_qReaped.push_back(from.shared_from_this());
+                return true;
+            }
+
         protected:
             // Thread safe queue for incoming messages
             tsqueue<owned_message<T>> m_qMessagesIn;
+            // messages taken off m_qMessagesIn awaiting dispatch, reused across updates
+            std::deque<owned_message<T>> m_deqBatch;
 
-            // container of active validated connections
-            std::deque<std::shared_ptr<connection<T>>> m_deqConnections;
+            // active connections, any thread may read them. only the game thread changes them, in Update()
+            connection_set<T> m_connections;
+
+            // connections accepted on asio thread, added to m_connections by the game thread
+            tsqueue<std::shared_ptr<connection<T>>> m_qAccepted;
+            std::vector<std::shared_ptr<connection<T>>> m_vAccepted;
+
+            // per player game state keyed by connection ID, game thread only.
+            // application adds entities, they are removed automatically on disconnect
+            entity_store m_entities;
 
             // order of declaration is important -> order of initialization
             asio::io_context m_asioContext;
             std::thread m_threadContext;
 
-            // need an asio context
+            // need an asio context, bound to port on Start() unless adopted from a previous process
             asio::ip::tcp::acceptor m_asioAcceptor;
+            uint16_t m_nPort = 0;
+            bool m_bAccepting = false;
 
             // clients need an identifier in the "wider system"
             uint32_t nIDCounter = 10000;
+
+            // idle/heartbeat timers for every connection, wheel is only touched on asio thread
+            asio::steady_timer m_timerWheel;
+            timing_wheel<std::weak_ptr<connection<T>>> m_timingWheel;
+            std::vector<std::weak_ptr<connection<T>>> m_vExpiredTimers;
+            std::chrono::milliseconds m_idleTimeout{0};
+            std::chrono::milliseconds m_heartbeatInterval{0};
+            message<T> m_msgHeartbeat;
+
+            // flood protection handed to each new connection
+            std::shared_ptr<const rate_limits<T>> m_pRateLimits;
+            uint32_t m_nMaxMessageSize = 16 * 1024 * 1024;
+            size_t m_nStreamChunkSize = 64 * 1024;
+
+            // tuning handed to each new connection
+            socket_options m_socketOptions;
+            bool m_bSocketOptionsRefused = false;
+
+            // optional recording of all inbound traffic
+            std::unique_ptr<capture_writer> m_pCapture;
+
+            // optional per stage latency histograms
+            std::unique_ptr<message_tracer> m_pTracer;
+
+#ifdef NETP_USE_TLS
+            // optional encryption of every connection
+            std::shared_ptr<tls_context> m_pTlsContext;
+#endif
+
+#ifndef _WIN32
+            // optional persistent player state, see EnablePersistence()
+            std::unique_ptr<state_store> m_pState;
+#endif
+
+            // connections expired on asio thread, waiting for game thread to remove them
+            tsqueue<std::shared_ptr<connection<T>>> m_qReaped;
+
+            // resumable sessions by token, only touched on asio thread
+            std::unordered_map<uint64_t, std::weak_ptr<connection<T>>> m_mapSessions;
+            std::mt19937_64 m_rngSessions{std::random_device{}()};
+            std::chrono::milliseconds m_sessionGrace{0};
+            size_t m_nReplayLimit = 0;
         };
     }
 }
\ No newline at end of file
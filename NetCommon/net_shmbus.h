@@ -0,0 +1,374 @@
+#pragma once
+#include "net_common.h"
+#include "net_message.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace netp
+{
+    namespace net
+    {
+#ifndef _WIN32
+        // start of a bus segment, slots follow at SHM_BUS_ALIGN granularity
+        struct shm_bus_header
+        {
+            char sMagic[8] = {'N', 'E', 'T', 'P', 'B', 'U', 'S', '1'};
+            uint32_t nSlots = 0;            // power of two
+            uint32_t nSlotSize = 0;         // bytes, slot header included
+            uint32_t nHeaderSize = 0;       // sizeof(message_header<T>) of the creating program
+            std::atomic<uint32_t> nReady{0}; // set once creator has laid out segment
+
+            // next publish position, every publisher claims one with fetch_add
+            alignas(64) std::atomic<uint64_t> nWrite{0};
+        };
+
+        // precedes message_header<T> & body in every slot. nSequence is a seqlock for position p:
+        // 2p+1 while being written, 2p+2 once complete, so readers can tell stale, torn & lapped slots apart
+        struct shm_bus_slot
+        {
+            std::atomic<uint64_t> nSequence{0};
+            uint64_t nSender = 0;
+            uint32_t nTopic = 0;
+            uint32_t nBodySize = 0;
+        };
+
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory bus needs lock free 64 bit atomics");
+
+        // message bus between processes on one host, eg. zone servers & a chat server, without touching the
+        // network stack. every process maps the same POSIX shared memory ring & publishes message<T> frames to
+        // numbered topics, every other process attached to the bus sees each one & picks the topics it subscribed to.
+        // publishing never blocks & never waits for readers: a reader that falls a whole ring behind loses the
+        // oldest messages (counted by GetLost()) rather than holding up the game. only the publisher that took a
+        // slot ever writes it, so one that died mid-copy leaves its slot stuck: publishers wait at most SHM_BUS_STALL
+        // on it before moving to the next position, readers step over it after as long. messages must fit in a slot.
+        // link with -lrt on older glibc
+        template <typename T>
+        class shm_bus
+        {
+        public:
+            // attach to bus sName (eg. "/mmo.bus"), creating it with nSlots of nSlotSize bytes if it does not exist
+            shm_bus(const std::string &sName, size_t nSlots = 4096, size_t nSlotSize = 1024)
+                : m_sName(sName)
+            {
+                std::random_device rd;
+                m_nSender = (uint64_t(rd()) << 32) | rd();
+
+                int fd = ::shm_open(sName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+                if (fd >= 0)
+                {
+                    Create(fd, nSlots, nSlotSize);
+                }
+                else if (errno == EEXIST)
+                {
+                    fd = ::shm_open(sName.c_str(), O_RDWR, 0600);
+                    if (fd < 0)
+                        throw std::runtime_error("unable to open shared memory bus " + sName);
+                    Attach(fd);
+                }
+                else
+                {
+                    throw std::runtime_error("unable to create shared memory bus " + sName);
+                }
+                ::close(fd);
+
+                // only messages published from now on are seen
+                m_nRead = m_pHeader->nWrite.load(std::memory_order_acquire);
+            }
+
+            shm_bus(const shm_bus &) = delete;
+
+            virtual ~shm_bus()
+            {
+                if (m_pHeader)
+                    ::munmap(m_pHeader, m_nMappedSize);
+            }
+
+            // remove bus name from system, processes still attached keep working. next shm_bus creates it afresh
+            static void Unlink(const std::string &sName)
+            {
+                ::shm_unlink(sName.c_str());
+            }
+
+        public:
+            // largest message body a slot can carry
+            size_t MaxBodySize() const
+            {
+                return m_pHeader->nSlotSize - sizeof(shm_bus_slot) - sizeof(message_header<T>);
+            }
+
+            // copy msg into ring for every other process on bus. safe from any thread, false if msg does not fit
+            bool Publish(uint32_t nTopic, const message<T> &msg)
+            {
+                if (msg.body.size() > MaxBodySize())
+                    return false;
+
+                uint64_t nPos = m_pHeader->nWrite.fetch_add(1, std::memory_order_relaxed);
+                shm_bus_slot *pSlot = SlotAt(nPos);
+
+                // take slot, waiting out a publisher a whole ring behind that is still copying into it. one that
+                // holds it for longer than SHM_BUS_STALL may have died mid-copy & is left to it, our position is
+                // given up (readers step over it) & the message goes to a fresh one
+                std::chrono::steady_clock::time_point tpGiveUp{};
+                uint64_t nSeq = pSlot->nSequence.load(std::memory_order_relaxed);
+                while ((nSeq & 1) || !pSlot->nSequence.compare_exchange_weak(nSeq, 2 * nPos + 1, std::memory_order_acquire))
+                {
+                    // a publisher a whole ring ahead got there first, this message is already overwritten for everyone
+                    if (nSeq > 2 * nPos)
+                        return true;
+
+                    if (nSeq & 1)
+                    {
+                        auto tpNow = std::chrono::steady_clock::now();
+                        if (tpGiveUp == std::chrono::steady_clock::time_point{})
+                            tpGiveUp = tpNow + SHM_BUS_STALL;
+                        else if (tpNow >= tpGiveUp)
+                        {
+                            m_nGivenUp.fetch_add(1, std::memory_order_relaxed);
+                            nPos = m_pHeader->nWrite.fetch_add(1, std::memory_order_relaxed);
+                            pSlot = SlotAt(nPos);
+                            tpGiveUp = {};
+                        }
+                    }
+
+                    std::this_thread::yield();
+                    nSeq = pSlot->nSequence.load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_release);
+
+                pSlot->nSender = m_nSender;
+                pSlot->nTopic = nTopic;
+                pSlot->nBodySize = uint32_t(msg.body.size());
+                uint8_t *pData = reinterpret_cast<uint8_t *>(pSlot + 1);
+                std::memcpy(pData, &msg.header, sizeof(message_header<T>));
+                if (!msg.body.empty())
+                    std::memcpy(pData + sizeof(message_header<T>), msg.body.data(), msg.body.size());
+
+                pSlot->nSequence.store(2 * nPos + 2, std::memory_order_release);
+                return true;
+            }
+
+            // receive messages of nTopic in OnMessage()
+            void Subscribe(uint32_t nTopic)
+            {
+                m_setTopics.insert(nTopic);
+            }
+
+            void Unsubscribe(uint32_t nTopic)
+            {
+                m_setTopics.erase(nTopic);
+            }
+
+            // hand every message published since last call to OnMessage(), up to nMaxMessages.
+            // call regularly from one thread, eg. once per game tick. returns number of messages handled
+            size_t Poll(size_t nMaxMessages = -1)
+            {
+                size_t nMessageCount = 0;
+                while (nMessageCount < nMaxMessages)
+                {
+                    shm_bus_slot *pSlot = SlotAt(m_nRead);
+                    uint64_t nSeq = pSlot->nSequence.load(std::memory_order_acquire);
+
+                    if (nSeq < 2 * m_nRead + 2)
+                    {
+                        // nothing new, or next message still being written
+                        if (!SkipStalled())
+                            break;
+                        continue;
+                    }
+
+                    if (nSeq > 2 * m_nRead + 2)
+                    {
+                        // ring has lapped us, skip to oldest message that can still be intact
+                        SkipLapped();
+                        continue;
+                    }
+
+                    // copy out, then make sure no publisher reused slot meanwhile
+                    uint32_t nTopic = pSlot->nTopic;
+                    uint64_t nSender = pSlot->nSender;
+                    uint32_t nBodySize = std::min<uint32_t>(pSlot->nBodySize, uint32_t(MaxBodySize()));
+                    const uint8_t *pData = reinterpret_cast<const uint8_t *>(pSlot + 1);
+
+                    bool bWanted = nSender != m_nSender && m_setTopics.count(nTopic) != 0;
+                    if (bWanted)
+                    {
+                        std::memcpy(&m_msgTemporary.header, pData, sizeof(message_header<T>));
+                        m_msgTemporary.body.resize(nBodySize);
+                        if (nBodySize > 0)
+                            std::memcpy(m_msgTemporary.body.data(), pData + sizeof(message_header<T>), nBodySize);
+                    }
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (pSlot->nSequence.load(std::memory_order_relaxed) != nSeq)
+                    {
+                        SkipLapped();
+                        continue;
+                    }
+
+                    m_nRead++;
+                    if (bWanted)
+                    {
+                        OnMessage(nTopic, m_msgTemporary);
+                        nMessageCount++;
+                    }
+                }
+                return nMessageCount;
+            }
+
+            // messages this process missed because it polled too slowly, or stepped over while stuck mid-write
+            uint64_t GetLost() const
+            {
+                return m_nLost;
+            }
+
+            // positions this process's publishers gave up because a slot stayed stuck mid-write for SHM_BUS_STALL
+            uint64_t GetGivenUp() const
+            {
+                return m_nGivenUp.load(std::memory_order_relaxed);
+            }
+
+        protected:
+            // called from Poll() for every message on a subscribed topic published by another process
+            virtual void OnMessage(uint32_t nTopic, message<T> &msg)
+            {
+            }
+
+        private:
+            void Create(int fd, size_t nSlots, size_t nSlotSize)
+            {
+                // slots are whole cache lines so neighbouring publishers do not share one
+                size_t nRoundedSlots = 1;
+                while (nRoundedSlots < nSlots)
+                    nRoundedSlots <<= 1;
+                nSlotSize = std::max(nSlotSize, sizeof(shm_bus_slot) + sizeof(message_header<T>));
+                nSlotSize = (nSlotSize + SHM_BUS_ALIGN - 1) & ~(SHM_BUS_ALIGN - 1);
+
+                m_nMappedSize = HeaderSpace() + nRoundedSlots * nSlotSize;
+                if (::ftruncate(fd, off_t(m_nMappedSize)) < 0)
+                {
+                    ::close(fd);
+                    ::shm_unlink(m_sName.c_str());
+                    throw std::runtime_error("unable to size shared memory bus " + m_sName);
+                }
+                Map(fd);
+
+                // fresh segment is zero filled, which is a valid empty slot for every position
+                m_pHeader = new (m_pHeader) shm_bus_header();
+                m_pHeader->nSlots = uint32_t(nRoundedSlots);
+                m_pHeader->nSlotSize = uint32_t(nSlotSize);
+                m_pHeader->nHeaderSize = uint32_t(sizeof(message_header<T>));
+                m_pHeader->nReady.store(1, std::memory_order_release);
+            }
+
+            void Attach(int fd)
+            {
+                // creator may still be sizing & laying out segment
+                struct stat st = {};
+                for (int i = 0; i < 1000 && (::fstat(fd, &st) < 0 || size_t(st.st_size) < HeaderSpace()); i++)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                if (size_t(st.st_size) < HeaderSpace())
+                {
+                    ::close(fd);
+                    throw std::runtime_error("shared memory bus never initialised " + m_sName);
+                }
+
+                m_nMappedSize = size_t(st.st_size);
+                Map(fd);
+
+                for (int i = 0; i < 1000 && m_pHeader->nReady.load(std::memory_order_acquire) == 0; i++)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+                shm_bus_header check;
+                if (m_pHeader->nReady.load(std::memory_order_acquire) == 0 ||
+                    std::memcmp(m_pHeader->sMagic, check.sMagic, sizeof(check.sMagic)) != 0 ||
+                    m_pHeader->nHeaderSize != sizeof(message_header<T>) ||
+                    m_nMappedSize < HeaderSpace() + size_t(m_pHeader->nSlots) * m_pHeader->nSlotSize)
+                {
+                    ::munmap(m_pHeader, m_nMappedSize);
+                    m_pHeader = nullptr;
+                    ::close(fd);
+                    throw std::runtime_error("not a shared memory bus for this message type " + m_sName);
+                }
+            }
+
+            void Map(int fd)
+            {
+                void *p = ::mmap(nullptr, m_nMappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED)
+                {
+                    ::close(fd);
+                    throw std::runtime_error("unable to map shared memory bus " + m_sName);
+                }
+                m_pHeader = static_cast<shm_bus_header *>(p);
+            }
+
+            static constexpr size_t HeaderSpace()
+            {
+                return (sizeof(shm_bus_header) + SHM_BUS_ALIGN - 1) & ~(SHM_BUS_ALIGN - 1);
+            }
+
+            shm_bus_slot *SlotAt(uint64_t nPos) const
+            {
+                uint8_t *pSlots = reinterpret_cast<uint8_t *>(m_pHeader) + HeaderSpace();
+                return reinterpret_cast<shm_bus_slot *>(pSlots + (nPos & (m_pHeader->nSlots - 1)) * m_pHeader->nSlotSize);
+            }
+
+            void SkipLapped()
+            {
+                uint64_t nWrite = m_pHeader->nWrite.load(std::memory_order_acquire);
+                uint64_t nOldest = nWrite > m_pHeader->nSlots ? nWrite - m_pHeader->nSlots : 0;
+                if (nOldest <= m_nRead)
+                    nOldest = m_nRead + 1;
+                m_nLost += nOldest - m_nRead;
+                m_nRead = nOldest;
+            }
+
+            // step over a position that was taken but has not been written for SHM_BUS_STALL, its publisher
+            // died or gave up on it. counted as lost, a slow publisher's message would be. false to wait longer
+            bool SkipStalled()
+            {
+                if (m_pHeader->nWrite.load(std::memory_order_acquire) <= m_nRead)
+                    return false;
+
+                auto tpNow = std::chrono::steady_clock::now();
+                if (m_nStalledAt != m_nRead)
+                {
+                    m_nStalledAt = m_nRead;
+                    m_tpStalled = tpNow + SHM_BUS_STALL;
+                    return false;
+                }
+                if (tpNow < m_tpStalled)
+                    return false;
+
+                m_nLost++;
+                m_nRead++;
+                return true;
+            }
+
+        private:
+            static constexpr size_t SHM_BUS_ALIGN = 64;
+            static constexpr std::chrono::milliseconds SHM_BUS_STALL{10};
+
+            std::string m_sName;
+            shm_bus_header *m_pHeader = nullptr;
+            size_t m_nMappedSize = 0;
+
+            // identifies our own publications, which are not handed back to us
+            uint64_t m_nSender = 0;
+            std::atomic<uint64_t> m_nGivenUp{0};
+
+            // reader state, only touched by thread calling Poll()
+            uint64_t m_nRead = 0;
+            uint64_t m_nLost = 0;
+            uint64_t m_nStalledAt = uint64_t(-1);
+            std::chrono::steady_clock::time_point m_tpStalled;
+            std::unordered_set<uint32_t> m_setTopics;
+            message<T> m_msgTemporary;
+        };
+#endif
+    }
+}
@@ -0,0 +1,197 @@
+#pragma once
+#include "net_common.h"
+#include "net_entity.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+namespace netp
+{
+    namespace net
+    {
+        // batch kernels over contiguous position arrays. the widest instruction set enabled at compile time
+        // is used (-mavx2, SSE2 is on by default for x86-64), anything else falls back to plain loops
+        namespace simd
+        {
+            // index of lowest set bit of a compare mask, nMask must not be 0
+            inline uint32_t LowestBit(uint32_t nMask)
+            {
+#ifdef _WIN32
+                unsigned long nIndex;
+                _BitScanForward(&nIndex, nMask);
+                return uint32_t(nIndex);
+#else
+                return uint32_t(__builtin_ctz(nMask));
+#endif
+            }
+
+            // p += v * dt for n entities
+            inline void IntegratePositions(float *px, float *py, float *pz,
+                                           const float *vx, const float *vy, const float *vz,
+                                           size_t n, float dt)
+            {
+                size_t i = 0;
+#if defined(__AVX2__)
+                __m256 vdt = _mm256_set1_ps(dt);
+                for (; i + 8 <= n; i += 8)
+                {
+                    _mm256_storeu_ps(px + i, _mm256_add_ps(_mm256_loadu_ps(px + i), _mm256_mul_ps(_mm256_loadu_ps(vx + i), vdt)));
+                    _mm256_storeu_ps(py + i, _mm256_add_ps(_mm256_loadu_ps(py + i), _mm256_mul_ps(_mm256_loadu_ps(vy + i), vdt)));
+                    _mm256_storeu_ps(pz + i, _mm256_add_ps(_mm256_loadu_ps(pz + i), _mm256_mul_ps(_mm256_loadu_ps(vz + i), vdt)));
+                }
+#elif defined(__SSE2__)
+                __m128 vdt = _mm_set1_ps(dt);
+                for (; i + 4 <= n; i += 4)
+                {
+                    _mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(_mm_loadu_ps(vx + i), vdt)));
+                    _mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(_mm_loadu_ps(vy + i), vdt)));
+                    _mm_storeu_ps(pz + i, _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(_mm_loadu_ps(vz + i), vdt)));
+                }
+#endif
+                for (; i < n; i++)
+                {
+                    px[i] += vx[i] * dt;
+                    py[i] += vy[i] * dt;
+                    pz[i] += vz[i] * dt;
+                }
+            }
+
+            // appends index of every entity within radius of (cx, cy, cz) to vOut, returns how many were added
+            inline size_t CullByRadius(const float *px, const float *py, const float *pz, size_t n,
+                                       float cx, float cy, float cz, float radius, std::vector<uint32_t> &vOut)
+            {
+                size_t nBefore = vOut.size();
+                float r2 = radius * radius;
+                size_t i = 0;
+#if defined(__AVX2__)
+                __m256 vcx = _mm256_set1_ps(cx), vcy = _mm256_set1_ps(cy), vcz = _mm256_set1_ps(cz);
+                __m256 vr2 = _mm256_set1_ps(r2);
+                for (; i + 8 <= n; i += 8)
+                {
+                    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(px + i), vcx);
+                    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(py + i), vcy);
+                    __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(pz + i), vcz);
+                    __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+
+                    // one bit per lane that passed, walk the set bits
+                    uint32_t nMask = uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(d2, vr2, _CMP_LE_OQ)));
+                    while (nMask)
+                    {
+                        vOut.push_back(uint32_t(i + LowestBit(nMask)));
+                        nMask &= nMask - 1;
+                    }
+                }
+#elif defined(__SSE2__)
+                __m128 vcx = _mm_set1_ps(cx), vcy = _mm_set1_ps(cy), vcz = _mm_set1_ps(cz);
+                __m128 vr2 = _mm_set1_ps(r2);
+                for (; i + 4 <= n; i += 4)
+                {
+                    __m128 dx = _mm_sub_ps(_mm_loadu_ps(px + i), vcx);
+                    __m128 dy = _mm_sub_ps(_mm_loadu_ps(py + i), vcy);
+                    __m128 dz = _mm_sub_ps(_mm_loadu_ps(pz + i), vcz);
+                    __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+                    uint32_t nMask = uint32_t(_mm_movemask_ps(_mm_cmple_ps(d2, vr2)));
+                    while (nMask)
+                    {
+                        vOut.push_back(uint32_t(i + LowestBit(nMask)));
+                        nMask &= nMask - 1;
+                    }
+                }
+#endif
+                for (; i < n; i++)
+                {
+                    float dx = px[i] - cx, dy = py[i] - cy, dz = pz[i] - cz;
+                    if (dx * dx + dy * dy + dz * dz <= r2)
+                        vOut.push_back(uint32_t(i));
+                }
+                return vOut.size() - nBefore;
+            }
+
+            // appends index of every entity inside the box [min, max] (inclusive) to vOut, returns how many were added
+            inline size_t FilterByBox(const float *px, const float *py, const float *pz, size_t n,
+                                      float minX, float minY, float minZ, float maxX, float maxY, float maxZ,
+                                      std::vector<uint32_t> &vOut)
+            {
+                size_t nBefore = vOut.size();
+                size_t i = 0;
+#if defined(__AVX2__)
+                __m256 vminX = _mm256_set1_ps(minX), vminY = _mm256_set1_ps(minY), vminZ = _mm256_set1_ps(minZ);
+                __m256 vmaxX = _mm256_set1_ps(maxX), vmaxY = _mm256_set1_ps(maxY), vmaxZ = _mm256_set1_ps(maxZ);
+                for (; i + 8 <= n; i += 8)
+                {
+                    __m256 x = _mm256_loadu_ps(px + i), y = _mm256_loadu_ps(py + i), z = _mm256_loadu_ps(pz + i);
+                    __m256 in = _mm256_and_ps(_mm256_cmp_ps(x, vminX, _CMP_GE_OQ), _mm256_cmp_ps(x, vmaxX, _CMP_LE_OQ));
+                    in = _mm256_and_ps(in, _mm256_and_ps(_mm256_cmp_ps(y, vminY, _CMP_GE_OQ), _mm256_cmp_ps(y, vmaxY, _CMP_LE_OQ)));
+                    in = _mm256_and_ps(in, _mm256_and_ps(_mm256_cmp_ps(z, vminZ, _CMP_GE_OQ), _mm256_cmp_ps(z, vmaxZ, _CMP_LE_OQ)));
+
+                    uint32_t nMask = uint32_t(_mm256_movemask_ps(in));
+                    while (nMask)
+                    {
+                        vOut.push_back(uint32_t(i + LowestBit(nMask)));
+                        nMask &= nMask - 1;
+                    }
+                }
+#elif defined(__SSE2__)
+                __m128 vminX = _mm_set1_ps(minX), vminY = _mm_set1_ps(minY), vminZ = _mm_set1_ps(minZ);
+                __m128 vmaxX = _mm_set1_ps(maxX), vmaxY = _mm_set1_ps(maxY), vmaxZ = _mm_set1_ps(maxZ);
+                for (; i + 4 <= n; i += 4)
+                {
+                    __m128 x = _mm_loadu_ps(px + i), y = _mm_loadu_ps(py + i), z = _mm_loadu_ps(pz + i);
+                    __m128 in = _mm_and_ps(_mm_cmpge_ps(x, vminX), _mm_cmple_ps(x, vmaxX));
+                    in = _mm_and_ps(in, _mm_and_ps(_mm_cmpge_ps(y, vminY), _mm_cmple_ps(y, vmaxY)));
+                    in = _mm_and_ps(in, _mm_and_ps(_mm_cmpge_ps(z, vminZ), _mm_cmple_ps(z, vmaxZ)));
+
+                    uint32_t nMask = uint32_t(_mm_movemask_ps(in));
+                    while (nMask)
+                    {
+                        vOut.push_back(uint32_t(i + LowestBit(nMask)));
+                        nMask &= nMask - 1;
+                    }
+                }
+#endif
+                for (; i < n; i++)
+                {
+                    if (px[i] >= minX && px[i] <= maxX && py[i] >= minY && py[i] <= maxY && pz[i] >= minZ && pz[i] <= maxZ)
+                        vOut.push_back(uint32_t(i));
+                }
+                return vOut.size() - nBefore;
+            }
+        }
+
+        // advance every entity in store by its velocity
+        inline void IntegrateMovement(entity_store &entities, float dt)
+        {
+            simd::IntegratePositions(entities.posX.data(), entities.posY.data(), entities.posZ.data(),
+                                     entities.velX.data(), entities.velY.data(), entities.velZ.data(),
+                                     entities.size(), dt);
+        }
+
+        // who-sees-whom: vLists[i] receives connection IDs of every other entity within radius of entity i,
+        // ready for server_interface::MessageClients(). vLists is resized to entities.size(), its storage reused
+        inline void BuildInterestLists(const entity_store &entities, float radius, std::vector<std::vector<uint32_t>> &vLists)
+        {
+            size_t n = entities.size();
+            vLists.resize(n);
+
+            std::vector<uint32_t> vNear;
+            for (size_t i = 0; i < n; i++)
+            {
+                vNear.clear();
+                simd::CullByRadius(entities.posX.data(), entities.posY.data(), entities.posZ.data(), n,
+                                   entities.posX[i], entities.posY[i], entities.posZ[i], radius, vNear);
+
+                auto &vList = vLists[i];
+                vList.clear();
+                for (uint32_t j : vNear)
+                    if (j != i)
+                        vList.push_back(entities.ids[j]);
+            }
+        }
+    }
+}
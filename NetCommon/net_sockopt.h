@@ -0,0 +1,97 @@
+#pragma once
+#include "net_common.h"
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+namespace netp
+{
+    namespace net
+    {
+        // socket settings applied to every connection of a server or client when it is accepted / connected.
+        // defaults favour latency of small game messages, everything else is left to the kernel
+        struct socket_options
+        {
+            // TCP_NODELAY - send small writes at once. with Nagle on, a write while earlier data is still
+            // unacknowledged waits for the ack, up to the peer's 40ms delayed ack timer
+            bool bNoDelay = true;
+
+            // SO_SNDBUF / SO_RCVBUF in bytes, 0 keeps kernel default (& its autotuning). large buffers help bulk
+            // transfers over long fat links, but queue more data ahead of urgent messages
+            int nSendBuffer = 0;
+            int nReceiveBuffer = 0;
+
+            // TCP_QUICKACK (linux) - ack every segment at once instead of delaying. kernel drops back to delayed
+            // acks by itself, so it is set again after every read at the cost of a syscall
+            bool bQuickAck = false;
+
+            // SO_BUSY_POLL (linux) - microseconds a blocking read spins on the device queue before sleeping.
+            // trades a core's worth of CPU for lower wakeup latency, needs CAP_NET_ADMIN to raise above sysctl
+            int nBusyPoll = 0;
+
+            // TCP_NOTSENT_LOWAT (linux, macOS) - socket only counts as writable while less than this many
+            // bytes are unsent, so little data waits in the kernel & the priority lanes decide what goes next
+            int nNotSentLowat = 0;
+        };
+
+        // applies options to an open socket, options the platform lacks are skipped. returns false if
+        // any setting was refused (eg. busy poll without privileges), the others still apply
+        inline bool ApplySocketOptions(asio::ip::tcp::socket &socket, const socket_options &options)
+        {
+            asio::error_code ec;
+            bool bOk = true;
+
+            socket.set_option(asio::ip::tcp::no_delay(options.bNoDelay), ec);
+            bOk = bOk && !ec;
+
+            if (options.nSendBuffer > 0)
+            {
+                socket.set_option(asio::socket_base::send_buffer_size(options.nSendBuffer), ec);
+                bOk = bOk && !ec;
+            }
+            if (options.nReceiveBuffer > 0)
+            {
+                socket.set_option(asio::socket_base::receive_buffer_size(options.nReceiveBuffer), ec);
+                bOk = bOk && !ec;
+            }
+
+#ifndef _WIN32
+            int fd = socket.native_handle();
+#ifdef TCP_QUICKACK
+            if (options.bQuickAck)
+            {
+                int nValue = 1;
+                bOk = ::setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &nValue, sizeof(nValue)) == 0 && bOk;
+            }
+#endif
+#ifdef SO_BUSY_POLL
+            if (options.nBusyPoll > 0)
+            {
+                int nValue = options.nBusyPoll;
+                bOk = ::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &nValue, sizeof(nValue)) == 0 && bOk;
+            }
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+            if (options.nNotSentLowat > 0)
+            {
+                int nValue = options.nNotSentLowat;
+                bOk = ::setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &nValue, sizeof(nValue)) == 0 && bOk;
+            }
+#endif
+#endif
+            return bOk;
+        }
+
+        // TCP_QUICKACK does not stick, set it again after each read
+        inline void RearmQuickAck(asio::ip::tcp::socket &socket)
+        {
+#if !defined(_WIN32) && defined(TCP_QUICKACK)
+            int nValue = 1;
+            ::setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_QUICKACK, &nValue, sizeof(nValue));
+#endif
+        }
+    }
+}
@@ -0,0 +1,337 @@
+#pragma once
+#include "net_common.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
+
+namespace netp
+{
+    namespace net
+    {
+#ifndef _WIN32
+        // body of a frame::chunk frame starts with this. first chunk of a stream (nOffset 0) is followed by
+        // nNameLength bytes of name, then comes the chunk's data which lands at nOffset of the file
+        struct chunk_header
+        {
+            uint32_t nStream = 0;
+            uint16_t nNameLength = 0;
+            uint16_t nFlags = 0; // none yet, must be zero
+            uint64_t nOffset = 0;
+            uint64_t nTotal = 0; // size of whole file
+        };
+
+        // body of message receiver gets once a stream is complete, pushed after the file's name so
+        // msg >> complete comes off first & the rest of the body is the name
+        struct stream_complete
+        {
+            uint64_t nBytes = 0;
+            uint32_t nStream = 0;
+            uint32_t nReserved = 0;
+        };
+
+        constexpr size_t STREAM_NAME_LIMIT = 200;          // leaves room for .part within NAME_MAX
+        constexpr size_t STREAM_CHUNK_LIMIT = 1024 * 1024; // largest chunk a receiver accepts
+        constexpr size_t STREAMS_IN_LIMIT = 8;             // streams one connection may receive at once
+
+        // names are a plain file name in receiver's stream directory, never a path
+        inline bool IsSafeStreamName(const std::string &sName)
+        {
+            return !sName.empty() && sName.size() <= STREAM_NAME_LIMIT && sName != "." && sName != ".." &&
+                   sName.find('/') == std::string::npos && sName.find('\0') == std::string::npos;
+        }
+
+        // sending side of a stream - a file read straight from page cache into the socket by sendfile,
+        // nothing of it is copied through user space
+        class file_stream_out
+        {
+        public:
+            file_stream_out(uint32_t nStream, const std::string &sPath, const std::string &sName)
+                : m_nStream(nStream), m_sName(sName)
+            {
+                m_nFile = ::open(sPath.c_str(), O_RDONLY | O_CLOEXEC);
+                struct stat st;
+                if (m_nFile >= 0 && ::fstat(m_nFile, &st) == 0 && S_ISREG(st.st_mode))
+                {
+                    m_nTotal = uint64_t(st.st_size);
+                    return;
+                }
+
+                if (m_nFile >= 0)
+                    ::close(m_nFile);
+                m_nFile = -1;
+            }
+
+            file_stream_out(const file_stream_out &) = delete;
+
+            ~file_stream_out()
+            {
+                if (m_nFile >= 0)
+                    ::close(m_nFile);
+            }
+
+        public:
+            bool IsOpen() const
+            {
+                return m_nFile >= 0;
+            }
+
+            uint32_t Stream() const
+            {
+                return m_nStream;
+            }
+
+            const std::string &Name() const
+            {
+                return m_sName;
+            }
+
+            uint64_t Total() const
+            {
+                return m_nTotal;
+            }
+
+            uint64_t Offset() const
+            {
+                return m_nOffset;
+            }
+
+            // every chunk has been written, an empty file still sends one to announce itself
+            bool Done() const
+            {
+                return m_bStarted && m_nOffset == m_nTotal;
+            }
+
+            // describe next chunk of up to nChunk bytes of data
+            chunk_header NextChunk(size_t nChunk)
+            {
+                chunk_header chunk;
+                chunk.nStream = m_nStream;
+                chunk.nOffset = m_nOffset;
+                chunk.nTotal = m_nTotal;
+                chunk.nNameLength = m_nOffset == 0 ? uint16_t(m_sName.size()) : 0;
+                m_nChunkData = size_t(std::min<uint64_t>(nChunk, m_nTotal - m_nOffset));
+                m_nChunkSent = 0;
+                m_bStarted = true;
+                return chunk;
+            }
+
+            // data bytes of the current chunk
+            size_t ChunkData() const
+            {
+                return m_nChunkData;
+            }
+
+            // sendfile as much of the current chunk as socket takes without blocking. true once all of
+            // it is sent, false with ec == errc::operation_would_block to wait for socket to become writable
+            bool SendChunk(int nSocket, std::error_code &ec)
+            {
+                ec = {};
+                while (m_nChunkSent < m_nChunkData)
+                {
+#ifdef __linux__
+                    off_t nFrom = off_t(m_nOffset + m_nChunkSent);
+                    ssize_t nSent = ::sendfile(nSocket, m_nFile, &nFrom, m_nChunkData - m_nChunkSent);
+#else
+                    // no sendfile of this shape elsewhere, bounce through a buffer
+                    uint8_t vBounce[16 * 1024];
+                    ssize_t nRead = ::pread(m_nFile, vBounce, std::min(sizeof(vBounce), m_nChunkData - m_nChunkSent), off_t(m_nOffset + m_nChunkSent));
+                    ssize_t nSent = nRead > 0 ? ::send(nSocket, vBounce, size_t(nRead), 0) : nRead;
+#endif
+                    if (nSent > 0)
+                    {
+                        m_nChunkSent += size_t(nSent);
+                        continue;
+                    }
+
+                    if (nSent < 0 && errno == EINTR)
+                        continue;
+                    if (nSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        ec = std::make_error_code(std::errc::operation_would_block);
+                    else if (nSent < 0)
+                        ec = std::error_code(errno, std::generic_category());
+                    else
+                        ec = std::make_error_code(std::errc::io_error); // file shrank under us
+                    return false;
+                }
+                return true;
+            }
+
+            // read current chunk's data into pData, for transports sendfile cannot go through (userspace TLS)
+            bool ReadChunk(uint8_t *pData)
+            {
+                size_t nDone = 0;
+                while (nDone < m_nChunkData)
+                {
+                    ssize_t nRead = ::pread(m_nFile, pData + nDone, m_nChunkData - nDone, off_t(m_nOffset + nDone));
+                    if (nRead < 0 && errno == EINTR)
+                        continue;
+                    if (nRead <= 0)
+                        return false;
+                    nDone += size_t(nRead);
+                }
+                m_nChunkSent = nDone;
+                return true;
+            }
+
+            // current chunk has been written
+            void CompleteChunk()
+            {
+                m_nOffset += m_nChunkData;
+                m_nChunkData = m_nChunkSent = 0;
+            }
+
+            // remote lost everything it had received, start again from the first chunk
+            void Restart()
+            {
+                m_nOffset = 0;
+                m_nChunkData = m_nChunkSent = 0;
+                m_bStarted = false;
+            }
+
+        private:
+            uint32_t m_nStream = 0;
+            std::string m_sName;
+            int m_nFile = -1;
+            uint64_t m_nTotal = 0;
+            uint64_t m_nOffset = 0;
+            size_t m_nChunkData = 0;
+            size_t m_nChunkSent = 0;
+            bool m_bStarted = false;
+        };
+
+        // receiving side of a stream - chunks are read from the socket straight into a shared mapping of
+        // the destination file, which is written as <name>.part & renamed once every byte has arrived.
+        // memory use is page cache the kernel can write back, not a buffer the size of the file
+        class file_stream_in
+        {
+        public:
+            file_stream_in() = default;
+            file_stream_in(const file_stream_in &) = delete;
+
+            ~file_stream_in()
+            {
+                Abort();
+            }
+
+        public:
+            // create sDirectory/sName.part of nTotal bytes & map it
+            bool Open(const std::string &sDirectory, const std::string &sName, uint64_t nTotal)
+            {
+                Abort();
+                m_sPath = sDirectory + "/" + sName;
+                m_sPartPath = m_sPath + ".part";
+                m_sName = sName;
+                m_nTotal = nTotal;
+                m_nReceived = 0;
+
+                m_nFile = ::open(m_sPartPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if (m_nFile < 0)
+                    return false;
+
+                // reserve every block up front. a sparse file would let a full disk or quota surface as SIGBUS
+                // on some later write into the mapping, instead of failing here where the stream can be dropped
+#ifdef __linux__
+                bool bSized = nTotal == 0 || ::posix_fallocate(m_nFile, 0, off_t(nTotal)) == 0;
+#else
+                bool bSized = ::ftruncate(m_nFile, off_t(nTotal)) == 0;
+#endif
+                if (!bSized)
+                {
+                    Abort();
+                    return false;
+                }
+
+                if (nTotal > 0)
+                {
+                    void *pMap = ::mmap(nullptr, size_t(nTotal), PROT_READ | PROT_WRITE, MAP_SHARED, m_nFile, 0);
+                    if (pMap == MAP_FAILED)
+                    {
+                        Abort();
+                        return false;
+                    }
+                    m_pData = static_cast<uint8_t *>(pMap);
+                }
+                return true;
+            }
+
+            bool IsOpen() const
+            {
+                return m_nFile >= 0;
+            }
+
+            const std::string &Name() const
+            {
+                return m_sName;
+            }
+
+            uint64_t Total() const
+            {
+                return m_nTotal;
+            }
+
+            // chunks arrive in order, the next one must start here
+            uint64_t Offset() const
+            {
+                return m_nReceived;
+            }
+
+            // where data for nOffset goes, caller has checked it lies within the file
+            uint8_t *Data(uint64_t nOffset)
+            {
+                return m_pData + nOffset;
+            }
+
+            // nBytes more have been placed, returns true once the whole file is in
+            bool Advance(size_t nBytes)
+            {
+                m_nReceived += nBytes;
+                return m_nReceived >= m_nTotal;
+            }
+
+            // unmap & move file to its final name
+            bool Finish()
+            {
+                Unmap();
+                bool bOk = ::close(m_nFile) == 0 && ::rename(m_sPartPath.c_str(), m_sPath.c_str()) == 0;
+                m_nFile = -1;
+                return bOk;
+            }
+
+            // throw away whatever was received
+            void Abort()
+            {
+                if (m_nFile < 0)
+                    return;
+
+                Unmap();
+                ::close(m_nFile);
+                ::unlink(m_sPartPath.c_str());
+                m_nFile = -1;
+            }
+
+        private:
+            void Unmap()
+            {
+                if (m_pData)
+                    ::munmap(m_pData, size_t(m_nTotal));
+                m_pData = nullptr;
+            }
+
+        private:
+            std::string m_sName;
+            std::string m_sPath;
+            std::string m_sPartPath;
+            int m_nFile = -1;
+            uint8_t *m_pData = nullptr;
+            uint64_t m_nTotal = 0;
+            uint64_t m_nReceived = 0;
+        };
+#endif
+    }
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include "net_common.h"
+#include "net_tsqueue.h"
+#include "net_message.h"
+#include "net_client.h"
+
+namespace netp
+{
+    namespace net
+    {
+        // runs many clients in one process for load tests & bots. instead of an io_context & thread each, clients
+        // built with client_interface(swarm) are spread over a small pool of io_contexts, one thread apiece, and
+        // what they receive lands in one queue that Update() dispatches to each client's OnMessage. every client
+        // stays on one context, so its connection is only ever touched by one thread as in a standalone client.
+        // clients must be destroyed before their swarm
+        template <typename T>
+        class client_swarm
+        {
+        public:
+            // nThreads 0 uses a thread per core
+            explicit client_swarm(size_t nThreads = 0)
+            {
+                if (nThreads == 0)
+                    nThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+                for (size_t i = 0; i < nThreads; i++)
+                {
+                    m_vContexts.push_back(std::make_unique<asio::io_context>(1));
+                    m_vWork.push_back(asio::make_work_guard(*m_vContexts.back()));
+                }
+                for (auto &pContext : m_vContexts)
+                    m_vThreads.emplace_back([pContext = pContext.get()]()
+                                            { pContext->run(); });
+            }
+
+            client_swarm(const client_swarm &) = delete;
+
+            virtual ~client_swarm()
+            {
+                m_vWork.clear();
+                for (auto &pContext : m_vContexts)
+                    pContext->stop();
+                for (auto &thread : m_vThreads)
+                    if (thread.joinable())
+                        thread.join();
+
+                // queued messages hold their connections, those must go before the contexts they belong to
+                m_qMessagesIn.clear();
+                m_deqBatch.clear();
+            }
+
+        public:
+            // receive buffer for each client's connection. bots mostly get small messages & many thousands of
+            // 64KB buffers add up, larger frames are still read straight into their message. takes effect on next Connect()
+            void SetReadBufferSize(size_t nBytes)
+            {
+                m_nReadBufferSize = nBytes;
+            }
+
+            size_t GetReadBufferSize() const
+            {
+                return m_nReadBufferSize;
+            }
+
+            size_t GetThreadCount() const
+            {
+                return m_vThreads.size();
+            }
+
+            size_t GetClientCount()
+            {
+                std::scoped_lock lock(m_muxClients);
+                return m_mapClients.size();
+            }
+
+            // dispatch up to nMaxMessages received by any client to its OnMessage, sleeping up to waitFor if
+            // nothing has arrived yet. returns number of messages handled. clients may connect & disconnect
+            // from their handlers, but should only be destroyed on the thread calling Update()
+            size_t Update(size_t nMaxMessages = -1, std::chrono::milliseconds waitFor = std::chrono::milliseconds(0))
+            {
+                if (waitFor.count() > 0)
+                    m_qMessagesIn.wait_for(waitFor);
+
+                size_t nMessageCount = 0;
+                while (nMessageCount < nMaxMessages && m_qMessagesIn.drain(m_deqBatch, std::min<size_t>(nMaxMessages - nMessageCount, 64)) > 0)
+                {
+                    int64_t nDequeue = TraceNow();
+                    while (!m_deqBatch.empty())
+                    {
+                        // a message from a connection whose client has since left is dropped
+                        auto &front = m_deqBatch.front();
+                        if (auto pClient = FindClient(front.remote.get()))
+                            pClient->DispatchMessage(front, nDequeue);
+                        m_deqBatch.pop_front();
+                        nMessageCount++;
+                    }
+                }
+                return nMessageCount;
+            }
+
+        private:
+            friend class client_interface<T>;
+
+            // context for a new client, handed out round robin
+            asio::io_context &NextContext()
+            {
+                return *m_vContexts[m_nNextContext.fetch_add(1, std::memory_order_relaxed) % m_vContexts.size()];
+            }
+
+            tsqueue<owned_message<T>> &Incoming()
+            {
+                return m_qMessagesIn;
+            }
+
+            // route what pConnection receives to pClient
+            void Join(const connection<T> *pConnection, client_interface<T> *pClient)
+            {
+                std::scoped_lock lock(m_muxClients);
+                m_mapClients[pConnection] = pClient;
+            }
+
+            // stop routing to a client that disconnected, anything still arriving from pConnection is dropped
+            void Leave(const connection<T> *pConnection)
+            {
+                std::scoped_lock lock(m_muxClients);
+                m_mapClients.erase(pConnection);
+            }
+
+            client_interface<T> *FindClient(const connection<T> *pConnection)
+            {
+                std::scoped_lock lock(m_muxClients);
+                auto it = m_mapClients.find(pConnection);
+                return it == m_mapClients.end() ? nullptr : it->second;
+            }
+
+        private:
+            // one thread per context, work guards keep them running while no client is connected
+            std::vector<std::unique_ptr<asio::io_context>> m_vContexts;
+            std::vector<asio::executor_work_guard<asio::io_context::executor_type>> m_vWork;
+            std::vector<std::thread> m_vThreads;
+            std::atomic<size_t> m_nNextContext = 0;
+            size_t m_nReadBufferSize = 4 * 1024;
+
+            // connection -> client it delivers to
+            std::mutex m_muxClients;
+            std::unordered_map<const connection<T> *, client_interface<T> *> m_mapClients;
+
+            // everything every client receives, & messages taken off it awaiting dispatch
+            tsqueue<owned_message<T>> m_qMessagesIn;
+            std::deque<owned_message<T>> m_deqBatch;
+        };
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "net_common.h"
+
+namespace netp
+{
+    namespace net
+    {
+        // hashed timing wheel - O(1) schedule and expiry for large numbers of timers
+        // (eg. one idle/heartbeat timer per connection). timers cannot be cancelled,
+        // the owner is expected to re-check its own deadline when a timer fires
+        template <typename Payload>
+        class timing_wheel
+        {
+        public:
+            timing_wheel(std::chrono::milliseconds tickInterval, size_t nSlots = 512)
+                : m_tickInterval(tickInterval)
+            {
+                // round slot count up to power of 2 so slot lookup is a mask
+                size_t n = 1;
+                while (n < nSlots)
+                    n <<= 1;
+                m_vSlots.resize(n);
+                m_nMask = n - 1;
+            }
+
+        public:
+            std::chrono::milliseconds TickInterval() const
+            {
+                return m_tickInterval;
+            }
+
+            // number of timers currently held by the wheel
+            size_t count() const
+            {
+                return m_nCount;
+            }
+
+            // schedule payload to expire after delay, rounded up to whole ticks
+            void Schedule(std::chrono::milliseconds delay, Payload payload)
+            {
+                uint64_t nTicks = uint64_t((delay.count() + m_tickInterval.count() - 1) / m_tickInterval.count());
+                if (nTicks == 0)
+                    nTicks = 1;
+
+                uint64_t nDeadline = m_nCurrentTick + nTicks;
+                m_vSlots[nDeadline & m_nMask].push_back({nDeadline, std::move(payload)});
+                m_nCount++;
+            }
+
+            // advance wheel by one tick, moving every expired payload into vExpired
+            void Advance(std::vector<Payload> &vExpired)
+            {
+                m_nCurrentTick++;
+                auto &slot = m_vSlots[m_nCurrentTick & m_nMask];
+
+                // entries with later deadlines hash to same slot, they stay for another revolution
+                size_t i = 0;
+                while (i < slot.size())
+                {
+                    if (slot[i].nDeadline <= m_nCurrentTick)
+                    {
+                        vExpired.push_back(std::move(slot[i].payload));
+                        slot[i] = std::move(slot.back());
+                        slot.pop_back();
+                        m_nCount--;
+                    }
+                    else
+                    {
+                        i++;
+                    }
+                }
+            }
+
+        private:
+            struct entry
+            {
+                uint64_t nDeadline = 0;
+                Payload payload;
+            };
+
+            std::vector<std::vector<entry>> m_vSlots;
+            size_t m_nMask = 0;
+            size_t m_nCount = 0;
+            uint64_t m_nCurrentTick = 0;
+            std::chrono::milliseconds m_tickInterval;
+        };
+    }
+}
@@ -0,0 +1,397 @@
+#pragma once
+#include "net_common.h"
+
+#ifdef NETP_USE_TLS
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#ifdef __linux__
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
+namespace netp
+{
+    namespace net
+    {
+        // next layer of a TLS stream - the connection's own socket, held by pointer so an established
+        // session can move to another connection along with its socket (see connection::Resume)
+        class tls_socket_ref
+        {
+        public:
+            using lowest_layer_type = asio::ip::tcp::socket::lowest_layer_type;
+            using executor_type = asio::ip::tcp::socket::executor_type;
+
+            explicit tls_socket_ref(asio::ip::tcp::socket *pSocket)
+                : m_pSocket(pSocket)
+            {
+            }
+
+            void Rebind(asio::ip::tcp::socket *pSocket)
+            {
+                m_pSocket = pSocket;
+            }
+
+            executor_type get_executor()
+            {
+                return m_pSocket->get_executor();
+            }
+
+            lowest_layer_type &lowest_layer()
+            {
+                return m_pSocket->lowest_layer();
+            }
+
+            const lowest_layer_type &lowest_layer() const
+            {
+                return m_pSocket->lowest_layer();
+            }
+
+            template <typename MutableBufferSequence, typename ReadHandler>
+            auto async_read_some(const MutableBufferSequence &buffers, ReadHandler &&handler)
+            {
+                return m_pSocket->async_read_some(buffers, std::forward<ReadHandler>(handler));
+            }
+
+            template <typename ConstBufferSequence, typename WriteHandler>
+            auto async_write_some(const ConstBufferSequence &buffers, WriteHandler &&handler)
+            {
+                return m_pSocket->async_write_some(buffers, std::forward<WriteHandler>(handler));
+            }
+
+        private:
+            asio::ip::tcp::socket *m_pSocket = nullptr;
+        };
+
+        using tls_stream = asio::ssl::stream<tls_socket_ref>;
+
+        // what a connection's handshake leaves behind for kernel TLS, filled in by openssl callbacks
+        struct tls_secrets
+        {
+            std::vector<uint8_t> vClientTraffic; // CLIENT_TRAFFIC_SECRET_0
+            std::vector<uint8_t> vServerTraffic; // SERVER_TRAFFIC_SECRET_0
+            uint64_t nTicketsSent = 0;           // records server sent under its traffic key before handshake completed
+        };
+
+        enum class tls_role
+        {
+            server,
+            client
+        };
+
+        // TLS 1.3 settings shared by all connections of a server or client. both ends are this library,
+        // so nothing older is offered. servers issue session tickets & clients keep the latest one, a
+        // reconnecting client resumes with it instead of paying for a full handshake
+        class tls_context
+        {
+        public:
+            explicit tls_context(tls_role role)
+                : m_role(role), m_ssl(role == tls_role::server ? asio::ssl::context::tls_server : asio::ssl::context::tls_client)
+            {
+                SSL_CTX *pCtx = m_ssl.native_handle();
+                SSL_CTX_set_min_proto_version(pCtx, TLS1_3_VERSION);
+                SSL_CTX_set_ex_data(pCtx, ContextIndex(), this);
+
+                if (role == tls_role::server)
+                {
+                    // one ticket per handshake is enough for one reconnect, each costs an encryption & a record
+                    SSL_CTX_set_num_tickets(pCtx, 1);
+                    SSL_CTX_set_session_ticket_cb(pCtx, &tls_context::OnGenerateTicket, &tls_context::OnDecryptTicket, nullptr);
+                }
+                else
+                {
+                    // tls 1.3 tickets arrive after the handshake, the callback catches them whenever they do
+                    SSL_CTX_set_session_cache_mode(pCtx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+                    SSL_CTX_sess_set_new_cb(pCtx, &tls_context::OnNewSession);
+                }
+            }
+
+            tls_context(const tls_context &) = delete;
+
+            ~tls_context()
+            {
+                if (m_pSession)
+                    SSL_SESSION_free(m_pSession);
+            }
+
+        public:
+            // server - certificate chain & private key from PEM files
+            bool UseCertificate(const std::string &sCertFile, const std::string &sKeyFile)
+            {
+                asio::error_code ec;
+                m_ssl.use_certificate_chain_file(sCertFile, ec);
+                if (!ec)
+                    m_ssl.use_private_key_file(sKeyFile, asio::ssl::context::pem, ec);
+                if (ec)
+                    Log() << "[TLS] Certificate Error: " << ec.message() << "\n";
+                return !ec;
+            }
+
+            // server - certificate made up on the spot, for tests & benchmarks where clients do not verify
+            bool UseSelfSigned(const std::string &sCommonName = "localhost")
+            {
+                EVP_PKEY *pKey = EVP_EC_gen("P-256");
+                X509 *pCert = X509_new();
+                bool bOk = pKey && pCert;
+                if (bOk)
+                {
+                    ASN1_INTEGER_set(X509_get_serialNumber(pCert), 1);
+                    X509_set_version(pCert, 2);
+                    X509_gmtime_adj(X509_getm_notBefore(pCert), 0);
+                    X509_gmtime_adj(X509_getm_notAfter(pCert), 365L * 24 * 3600);
+                    X509_set_pubkey(pCert, pKey);
+
+                    X509_NAME *pName = X509_get_subject_name(pCert);
+                    X509_NAME_add_entry_by_txt(pName, "CN", MBSTRING_ASC, (const unsigned char *)sCommonName.c_str(), -1, -1, 0);
+                    X509_set_issuer_name(pCert, pName);
+
+                    bOk = X509_sign(pCert, pKey, EVP_sha256()) > 0 &&
+                          SSL_CTX_use_certificate(m_ssl.native_handle(), pCert) == 1 &&
+                          SSL_CTX_use_PrivateKey(m_ssl.native_handle(), pKey) == 1;
+                }
+
+                X509_free(pCert);
+                EVP_PKEY_free(pKey);
+                return bOk;
+            }
+
+            // client - verify server's certificate against CAs in a PEM file. without it the link is
+            // encrypted but the server is not authenticated
+            bool VerifyWith(const std::string &sCAFile)
+            {
+                asio::error_code ec;
+                m_ssl.load_verify_file(sCAFile, ec);
+                if (!ec)
+                    m_ssl.set_verify_mode(asio::ssl::verify_peer, ec);
+                if (ec)
+                    Log() << "[TLS] Verify Error: " << ec.message() << "\n";
+                return !ec;
+            }
+
+            // hand encryption of sent data to the kernel (linux kTLS, needs the tls module) for connections
+            // that negotiate an AES-GCM suite. decryption stays in openssl. falls back silently if unsupported
+            void SetKernelTls(bool bEnable)
+            {
+                // kernel needs the traffic secrets, openssl only hands them out through its key log
+                m_bKernelTls = bEnable;
+                SSL_CTX_set_keylog_callback(m_ssl.native_handle(), bEnable ? &tls_context::OnKeylog : nullptr);
+            }
+
+            bool KernelTls() const
+            {
+                return m_bKernelTls;
+            }
+
+            tls_role Role() const
+            {
+                return m_role;
+            }
+
+            asio::ssl::context &native()
+            {
+                return m_ssl;
+            }
+
+            // client - latest session ticket from server, offered by next handshake
+            void ResumeSession(SSL *pSSL)
+            {
+                std::scoped_lock lock(m_muxSession);
+                if (m_pSession)
+                    SSL_set_session(pSSL, m_pSession);
+            }
+
+            // handshakes that resumed a session rather than doing a full one
+            uint64_t ResumedHandshakes() const
+            {
+                return m_nResumed.load(std::memory_order_relaxed);
+            }
+
+            uint64_t FullHandshakes() const
+            {
+                return m_nFull.load(std::memory_order_relaxed);
+            }
+
+            void CountHandshake(SSL *pSSL)
+            {
+                if (SSL_session_reused(pSSL))
+                    m_nResumed.fetch_add(1, std::memory_order_relaxed);
+                else
+                    m_nFull.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // where openssl callbacks find a connection's tls_secrets
+            static int SecretsIndex()
+            {
+                static int nIndex = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+                return nIndex;
+            }
+
+        private:
+            static int ContextIndex()
+            {
+                static int nIndex = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+                return nIndex;
+            }
+
+            static void OnKeylog(const SSL *pSSL, const char *sLine)
+            {
+                auto pSecrets = static_cast<tls_secrets *>(SSL_get_ex_data(pSSL, SecretsIndex()));
+                if (!pSecrets)
+                    return;
+
+                // "<label> <client random hex> <secret hex>"
+                std::string s(sLine);
+                std::vector<uint8_t> *pTarget = nullptr;
+                if (s.rfind("CLIENT_TRAFFIC_SECRET_0 ", 0) == 0)
+                    pTarget = &pSecrets->vClientTraffic;
+                else if (s.rfind("SERVER_TRAFFIC_SECRET_0 ", 0) == 0)
+                    pTarget = &pSecrets->vServerTraffic;
+                else
+                    return;
+
+                std::string sHex = s.substr(s.rfind(' ') + 1);
+                pTarget->clear();
+                for (size_t i = 0; i + 1 < sHex.size(); i += 2)
+                    pTarget->push_back(uint8_t(std::stoul(sHex.substr(i, 2), nullptr, 16)));
+            }
+
+            static int OnGenerateTicket(SSL *pSSL, void *)
+            {
+                if (auto pSecrets = static_cast<tls_secrets *>(SSL_get_ex_data(pSSL, SecretsIndex())))
+                    pSecrets->nTicketsSent++;
+                return 1;
+            }
+
+            // same decisions openssl makes without a callback
+            static SSL_TICKET_RETURN OnDecryptTicket(SSL *, SSL_SESSION *, const unsigned char *, size_t,
+                                                     SSL_TICKET_STATUS status, void *)
+            {
+                switch (status)
+                {
+                case SSL_TICKET_SUCCESS:
+                    return SSL_TICKET_RETURN_USE;
+                case SSL_TICKET_SUCCESS_RENEW:
+                    return SSL_TICKET_RETURN_USE_RENEW;
+                case SSL_TICKET_FATAL_ERR_MALLOC:
+                case SSL_TICKET_FATAL_ERR_OTHER:
+                    return SSL_TICKET_RETURN_ABORT;
+                default:
+                    return SSL_TICKET_RETURN_IGNORE_RENEW;
+                }
+            }
+
+            static int OnNewSession(SSL *pSSL, SSL_SESSION *pSession)
+            {
+                auto pContext = static_cast<tls_context *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(pSSL), ContextIndex()));
+                if (!pContext)
+                    return 0;
+
+                std::scoped_lock lock(pContext->m_muxSession);
+                if (pContext->m_pSession)
+                    SSL_SESSION_free(pContext->m_pSession);
+                pContext->m_pSession = pSession;
+                return 1; // keeping the reference
+            }
+
+        private:
+            tls_role m_role;
+            asio::ssl::context m_ssl;
+            bool m_bKernelTls = false;
+
+            // client - session to resume, set from asio threads of every connection sharing the context
+            std::mutex m_muxSession;
+            SSL_SESSION *m_pSession = nullptr;
+
+            std::atomic<uint64_t> m_nResumed{0};
+            std::atomic<uint64_t> m_nFull{0};
+        };
+
+        // tls 1.3 HKDF-Expand-Label with an empty context, derives record keys from a traffic secret
+        inline bool HkdfExpandLabel(const EVP_MD *pDigest, const std::vector<uint8_t> &vSecret, const char *sLabel,
+                                    uint8_t *pOut, size_t nOut)
+        {
+            std::string sFullLabel = std::string("tls13 ") + sLabel;
+            std::vector<uint8_t> vInfo = {uint8_t(nOut >> 8), uint8_t(nOut), uint8_t(sFullLabel.size())};
+            vInfo.insert(vInfo.end(), sFullLabel.begin(), sFullLabel.end());
+            vInfo.push_back(0);
+
+            EVP_PKEY_CTX *pCtx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+            bool bOk = pCtx && EVP_PKEY_derive_init(pCtx) > 0 &&
+                       EVP_PKEY_CTX_set_hkdf_mode(pCtx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0 &&
+                       EVP_PKEY_CTX_set_hkdf_md(pCtx, pDigest) > 0 &&
+                       EVP_PKEY_CTX_set1_hkdf_key(pCtx, vSecret.data(), int(vSecret.size())) > 0 &&
+                       EVP_PKEY_CTX_add1_hkdf_info(pCtx, vInfo.data(), int(vInfo.size())) > 0 &&
+                       EVP_PKEY_derive(pCtx, pOut, &nOut) > 0;
+            EVP_PKEY_CTX_free(pCtx);
+            return bOk;
+        }
+
+#if defined(__linux__) && defined(TLS_TX) && defined(TLS_1_3_VERSION)
+        // fill kernel's description of one direction of a tls 1.3 AES-GCM session & install it on fd
+        template <typename CryptoInfo>
+        bool InstallKernelTlsTx(int fd, uint16_t nCipherType, const EVP_MD *pDigest, const std::vector<uint8_t> &vSecret, uint64_t nSequence)
+        {
+            CryptoInfo info{};
+            info.info.version = TLS_1_3_VERSION;
+            info.info.cipher_type = nCipherType;
+
+            // kernel splits the 12 byte static iv into salt & iv
+            uint8_t pIV[sizeof(info.salt) + sizeof(info.iv)];
+            if (!HkdfExpandLabel(pDigest, vSecret, "key", info.key, sizeof(info.key)) ||
+                !HkdfExpandLabel(pDigest, vSecret, "iv", pIV, sizeof(pIV)))
+                return false;
+            std::memcpy(info.salt, pIV, sizeof(info.salt));
+            std::memcpy(info.iv, pIV + sizeof(info.salt), sizeof(info.iv));
+            for (size_t i = 0; i < sizeof(info.rec_seq); i++)
+                info.rec_seq[i] = uint8_t(nSequence >> (8 * (sizeof(info.rec_seq) - 1 - i)));
+
+            bool bOk = ::setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0 &&
+                       ::setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info)) == 0;
+            OPENSSL_cleanse(&info, sizeof(info));
+            OPENSSL_cleanse(pIV, sizeof(pIV));
+            return bOk;
+        }
+#endif
+
+        // after the handshake, let the kernel encrypt everything written to socket from now on. returns false
+        // (nothing changed) unless suite is AES-GCM & the kernel accepts it. openssl must not write to
+        // the socket afterwards, its record sequence would no longer match
+        inline bool EnableKernelTlsTx(SSL *pSSL, asio::ip::tcp::socket &socket, tls_role role, const tls_secrets &secrets)
+        {
+#if defined(__linux__) && defined(TLS_TX) && defined(TLS_1_3_VERSION)
+            if (SSL_version(pSSL) != TLS1_3_VERSION)
+                return false;
+
+            const std::vector<uint8_t> &vSecret = role == tls_role::server ? secrets.vServerTraffic : secrets.vClientTraffic;
+            uint64_t nSequence = role == tls_role::server ? secrets.nTicketsSent : 0;
+            if (vSecret.empty())
+                return false;
+
+            switch (SSL_CIPHER_get_id(SSL_get_current_cipher(pSSL)))
+            {
+            case TLS1_3_CK_AES_128_GCM_SHA256:
+                return InstallKernelTlsTx<tls12_crypto_info_aes_gcm_128>(socket.native_handle(), TLS_CIPHER_AES_GCM_128,
+                                                                         EVP_sha256(), vSecret, nSequence);
+            case TLS1_3_CK_AES_256_GCM_SHA384:
+                return InstallKernelTlsTx<tls12_crypto_info_aes_gcm_256>(socket.native_handle(), TLS_CIPHER_AES_GCM_256,
+                                                                         EVP_sha384(), vSecret, nSequence);
+            default:
+                return false;
+            }
+#else
+            return false;
+#endif
+        }
+    }
+}
+#endif
@@ -0,0 +1,226 @@
+#pragma once
+#include "net_common.h"
+
+namespace netp
+{
+    namespace net
+    {
+        // monotonic time in nanoseconds used for trace stamps, 0 means a message is not traced
+        inline int64_t TraceNow()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+        inline int64_t TraceStamp(std::chrono::steady_clock::time_point tp)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+        }
+
+        // stamps an inbound message collects on the asio thread, rest are taken by the game thread
+        struct trace_stamps
+        {
+            int64_t nRead = 0;    // read completion that finished the message
+            int64_t nEnqueue = 0; // handed to incoming queue
+        };
+
+        // intervals between stamps a message passes through
+        enum class trace_stage : uint8_t
+        {
+            admit,    // read complete -> enqueue: framing, reassembly, rate limiting
+            inbound,  // enqueue -> dequeue: waiting in m_qMessagesIn for the game thread
+            dispatch, // dequeue -> handler start: waiting behind rest of the batch
+            handler,  // handler start -> end: OnMessage
+            outbound, // Send() -> write complete: post to asio thread, lanes backlog & socket write
+            total     // read complete -> handler end
+        };
+
+        constexpr size_t TRACE_STAGES = 6;
+
+        // histogram of latencies in nanoseconds, buckets are 8 per power of two so any value is within
+        // 12.5% of the bucket it lands in. recording is a relaxed atomic add, safe from any thread
+        class latency_histogram
+        {
+        public:
+            static constexpr size_t BUCKETS = 62 * 8;
+
+        public:
+            void Record(int64_t nNanoseconds)
+            {
+                uint64_t nValue = uint64_t(std::max<int64_t>(nNanoseconds, 0));
+                m_nBuckets[BucketOf(nValue)].fetch_add(1, std::memory_order_relaxed);
+                m_nCount.fetch_add(1, std::memory_order_relaxed);
+                m_nSum.fetch_add(nValue, std::memory_order_relaxed);
+
+                uint64_t nMax = m_nMax.load(std::memory_order_relaxed);
+                while (nValue > nMax && !m_nMax.compare_exchange_weak(nMax, nValue, std::memory_order_relaxed))
+                    ;
+            }
+
+            uint64_t Count() const
+            {
+                return m_nCount.load(std::memory_order_relaxed);
+            }
+
+            uint64_t Max() const
+            {
+                return m_nMax.load(std::memory_order_relaxed);
+            }
+
+            double Mean() const
+            {
+                uint64_t nCount = Count();
+                return nCount ? double(m_nSum.load(std::memory_order_relaxed)) / double(nCount) : 0.0;
+            }
+
+            // upper edge of bucket holding the dPercentile'th value (0 - 100), never more than Max()
+            uint64_t Percentile(double dPercentile) const
+            {
+                uint64_t nCount = Count();
+                if (nCount == 0)
+                    return 0;
+
+                uint64_t nRank = uint64_t(std::ceil(dPercentile / 100.0 * double(nCount)));
+                nRank = std::clamp<uint64_t>(nRank, 1, nCount);
+
+                uint64_t nSeen = 0;
+                for (size_t i = 0; i < BUCKETS; i++)
+                {
+                    nSeen += m_nBuckets[i].load(std::memory_order_relaxed);
+                    if (nSeen >= nRank)
+                        return std::min(BucketUpper(i), Max());
+                }
+                return Max();
+            }
+
+            void Reset()
+            {
+                for (auto &n : m_nBuckets)
+                    n.store(0, std::memory_order_relaxed);
+                m_nCount.store(0, std::memory_order_relaxed);
+                m_nSum.store(0, std::memory_order_relaxed);
+                m_nMax.store(0, std::memory_order_relaxed);
+            }
+
+        private:
+            // values below 8 get a bucket each, above that the top 4 significant bits pick one
+            static size_t BucketOf(uint64_t nValue)
+            {
+                if (nValue < 8)
+                    return size_t(nValue);
+
+                int nMsb = 63;
+                while (!(nValue >> nMsb))
+                    nMsb--;
+                return std::min<size_t>(size_t(nMsb - 2) * 8 + ((nValue >> (nMsb - 3)) & 7), BUCKETS - 1);
+            }
+
+            static uint64_t BucketUpper(size_t nBucket)
+            {
+                if (nBucket < 8)
+                    return nBucket;
+
+                size_t nShift = nBucket / 8 - 1;
+                return ((8 + nBucket % 8 + 1) << nShift) - 1;
+            }
+
+        private:
+            std::array<std::atomic<uint64_t>, BUCKETS> m_nBuckets{};
+            std::atomic<uint64_t> m_nCount{0};
+            std::atomic<uint64_t> m_nSum{0};
+            std::atomic<uint64_t> m_nMax{0};
+        };
+
+        // per stage latency histograms of a server's or client's messages. only 1 in nSampleEvery messages
+        // is traced, the others cost a counter increment. 0 switches tracing off, 1 traces everything
+        class message_tracer
+        {
+        public:
+            explicit message_tracer(uint32_t nSampleEvery = 1)
+                : m_nSampleEvery(nSampleEvery)
+            {
+            }
+
+        public:
+            // may be changed while running, from any thread
+            void SetSampling(uint32_t nSampleEvery)
+            {
+                m_nSampleEvery.store(nSampleEvery, std::memory_order_relaxed);
+            }
+
+            // true if the message about to enter the pipeline should be stamped. each direction counts on its
+            // own, one shared count would alias with request/reply traffic & only ever pick one direction
+            bool SampleInbound()
+            {
+                return Sample(m_nInbound);
+            }
+
+            bool SampleOutbound()
+            {
+                return Sample(m_nOutbound);
+            }
+
+            void Record(trace_stage stage, int64_t nFrom, int64_t nTo)
+            {
+                m_histograms[size_t(stage)].Record(nTo - nFrom);
+            }
+
+            // game thread, once a traced inbound message has been handled
+            void RecordInbound(const trace_stamps &trace, int64_t nDequeue, int64_t nHandlerStart, int64_t nHandlerEnd)
+            {
+                Record(trace_stage::admit, trace.nRead, trace.nEnqueue);
+                Record(trace_stage::inbound, trace.nEnqueue, nDequeue);
+                Record(trace_stage::dispatch, nDequeue, nHandlerStart);
+                Record(trace_stage::handler, nHandlerStart, nHandlerEnd);
+                Record(trace_stage::total, trace.nRead, nHandlerEnd);
+            }
+
+            const latency_histogram &Histogram(trace_stage stage) const
+            {
+                return m_histograms[size_t(stage)];
+            }
+
+            void Reset()
+            {
+                for (auto &h : m_histograms)
+                    h.Reset();
+            }
+
+            // table of every stage in microseconds
+            void Print(std::ostream &os) const
+            {
+                static const char *sStages[TRACE_STAGES] = {"admit", "inbound", "dispatch", "handler", "outbound", "total"};
+
+                char sLine[160];
+                std::snprintf(sLine, sizeof(sLine), "%-9s %10s %10s %10s %10s %10s %10s %10s\n",
+                              "stage", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+                os << sLine;
+                for (size_t i = 0; i < TRACE_STAGES; i++)
+                {
+                    auto &h = m_histograms[i];
+                    std::snprintf(sLine, sizeof(sLine), "%-9s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                                  sStages[i], (unsigned long long)h.Count(), h.Mean() / 1000.0,
+                                  h.Percentile(50) / 1000.0, h.Percentile(90) / 1000.0, h.Percentile(99) / 1000.0,
+                                  h.Percentile(99.9) / 1000.0, h.Max() / 1000.0);
+                    os << sLine;
+                }
+            }
+
+        private:
+            bool Sample(std::atomic<uint32_t> &nCounter)
+            {
+                uint32_t nEvery = m_nSampleEvery.load(std::memory_order_relaxed);
+                if (nEvery <= 1)
+                    return nEvery == 1;
+                return nCounter.fetch_add(1, std::memory_order_relaxed) % nEvery == 0;
+            }
+
+        private:
+            std::atomic<uint32_t> m_nSampleEvery;
+            std::atomic<uint32_t> m_nInbound{0};
+            std::atomic<uint32_t> m_nOutbound{0};
+            std::array<latency_histogram, TRACE_STAGES> m_histograms;
+        };
+    }
+}
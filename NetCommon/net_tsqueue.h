@@ -30,18 +30,24 @@ namespace netp
             // add item to back
             void push_back(const T &item)
             {
-                std::scoped_lock lock(muxQueue);
-                deqQueue.emplace_back(std::move(item));
+                {
+                    std::scoped_lock lock(muxQueue);
+                    deqQueue.emplace_back(std::move(item));
+                }
 
+                // queue lock released first, waiters check emptiness while holding muxBlocking
                 std::unique_lock<std::mutex> ul(muxBlocking);
                 cvBlocking.notify_one();
             }
 
             void push_front(const T &item)
             {
-                std::scoped_lock lock(muxQueue);
-                deqQueue.emplace_front(std::move(item));
+                {
+                    std::scoped_lock lock(muxQueue);
+                    deqQueue.emplace_front(std::move(item));
+                }
 
+                // queue lock released first, waiters check emptiness while holding muxBlocking
                 std::unique_lock<std::mutex> ul(muxBlocking);
                 cvBlocking.notify_one();
             }
@@ -83,13 +89,31 @@ namespace netp
                 return t;
             }
 
+            // moves up to nMax items from front of queue into out under a single lock, returns count moved
+            size_t drain(std::deque<T> &out, size_t nMax = -1)
+            {
+                std::scoped_lock lock(muxQueue);
+                size_t n = std::min(nMax, deqQueue.size());
+                std::move(deqQueue.begin(), deqQueue.begin() + n, std::back_inserter(out));
+                deqQueue.erase(deqQueue.begin(), deqQueue.begin() + n);
+                return n;
+            }
+
+            // blocks until queue has an item
             void wait()
             {
-                while (empty())
-                {
-                    std::unique_lock<std::mutex> ul(muxBlocking);
-                    cvBlocking.wait(ul);
-                }
+                std::unique_lock<std::mutex> ul(muxBlocking);
+                cvBlocking.wait(ul, [this]()
+                                { return !empty(); });
+            }
+
+            // blocks until queue has an item or timeout expires, returns true if queue has items
+            template <typename Rep, typename Period>
+            bool wait_for(const std::chrono::duration<Rep, Period> &timeout)
+            {
+                std::unique_lock<std::mutex> ul(muxBlocking);
+                return cvBlocking.wait_for(ul, timeout, [this]()
+                                           { return !empty(); });
             }
 
         protected:
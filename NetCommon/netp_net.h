@@ -3,6 +3,22 @@
 #include "net_common.h"
 #include "net_tsqueue.h"
 #include "net_message.h"
+#include "net_lanes.h"
+#include "net_ratelimit.h"
+#include "net_trace.h"
+#include "net_sockopt.h"
+#include "net_tls.h"
+#include "net_stream.h"
+#include "net_timer.h"
+#include "net_entity.h"
+#include "net_simd.h"
 #include "net_client.h"
+#include "net_swarm.h"
 #include "net_server.h"
-#include "net_connection.h"
\ No newline at end of file
+#include "net_connection.h"
+#include "net_capture.h"
+#include "net_replay.h"
+#include "net_handoff.h"
+#include "net_shmbus.h"
+#include "net_persist.h"
+#include "net_connset.h"
\ No newline at end of file
@@ -1,5 +1,6 @@
 
 #include <iostream>
+#include <csignal>
 #include "../NetCommon/netp_net.h"
 
 enum class CustomMsgTypes : uint32_t
@@ -9,6 +10,8 @@ enum class CustomMsgTypes : uint32_t
     ServerPing,
     MessageAll,
     ServerMessage,
+    Heartbeat,
+    ServerShutdown,
 };
 
 class CustomServer : public netp::net::server_interface<CustomMsgTypes>
@@ -16,6 +19,22 @@ class CustomServer : public netp::net::server_interface<CustomMsgTypes>
 public:
     CustomServer(uint16_t nPort) : netp::net::server_interface<CustomMsgTypes>(nPort)
     {
+        // clients answer heartbeats, so anything silent for 3 intervals is dead
+        netp::net::message<CustomMsgTypes> msg;
+        msg.header.id = CustomMsgTypes::Heartbeat;
+        SetHeartbeat(std::chrono::seconds(5), msg);
+        SetIdleTimeout(std::chrono::seconds(15));
+
+        // clients that drop out can pick their session back up within 30 seconds
+        EnableSessionResume(std::chrono::seconds(30));
+
+        // a human pressing keys never gets near this, a flooding client is slowed down
+        netp::net::rate_limits<CustomMsgTypes> limits;
+        limits.messages = {50.0, 100.0};
+        limits.bytes = {64.0 * 1024, 256.0 * 1024};
+        limits.nAction = netp::net::limit_action::delay;
+        SetRateLimits(limits);
+        SetMaxMessageSize(64 * 1024);
     }
 
 protected:
@@ -62,15 +81,66 @@ protected:
     }
 };
 
-int main()
+// SIGTERM / SIGINT drain the server, SIGUSR2 hands it over to a new instance started with --adopt
+static volatile std::sig_atomic_t g_nSignal = 0;
+static const char *HANDOFF_PATH = "/tmp/SimpleServer.handoff";
+
+void OnSignal(int nSignal)
+{
+    g_nSignal = nSignal;
+}
+
+int main(int argc, char *argv[])
 {
+    // SimpleServer --replay <file> [speed] : run captured traffic through the handlers & exit
+    if (argc >= 3 && std::string(argv[1]) == "--replay")
+    {
+        // port 0 - replay must not clash with a live server
+        CustomServer server(0);
+        netp::net::capture_replayer<CustomMsgTypes> replayer(server);
+
+        auto tpStart = std::chrono::steady_clock::now();
+        size_t nMessages = replayer.Replay(argv[2], argc >= 4 ? std::stod(argv[3]) : 1.0);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - tpStart;
+
+        std::cout << "[REPLAY] " << nMessages << " messages in " << elapsed.count() << "s\n";
+        return 0;
+    }
+
     CustomServer server(60000);
+
+    // SimpleServer --capture <file> : record all client traffic for later replay
+    if (argc >= 3 && std::string(argv[1]) == "--capture")
+        server.EnableCapture(argv[2]);
+
+    // SimpleServer --trace <n> : time 1 in n messages through each stage, histograms printed on exit
+    if (argc >= 3 && std::string(argv[1]) == "--trace")
+        server.EnableTracing(uint32_t(std::stoul(argv[2])));
+
+    // SimpleServer --adopt : wait for the running instance to be sent SIGUSR2, then carry on with its clients
+    if (argc >= 2 && std::string(argv[1]) == "--adopt" && !server.AdoptFrom(HANDOFF_PATH))
+        return 1;
+
     server.Start();
 
-    while (1)
+    std::signal(SIGTERM, OnSignal);
+    std::signal(SIGINT, OnSignal);
+    std::signal(SIGUSR2, OnSignal);
+
+    while (g_nSignal == 0)
     {
-        server.Update(-1, true);
+        server.Update(-1, std::chrono::milliseconds(100));
     }
 
+    if (g_nSignal == SIGUSR2 && server.HandoffTo(HANDOFF_PATH))
+        return 0;
+
+    netp::net::message<CustomMsgTypes> msg;
+    msg.header.id = CustomMsgTypes::ServerShutdown;
+    server.Drain(std::chrono::seconds(5), msg);
+
+    if (server.GetTracer())
+        server.GetTracer()->Print(std::cout);
+
     return 0;
 }
\ No newline at end of file